@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+#include "stb/stb_image.h"
+#include "sinogram.h"
+#include "sysmatrix.h"
+#include "threads.h"
+#include "trace.h"
+
+/*
+ * Batch mode.
+ *
+ * Every slice of a stack goes through three stages running on their own threads: a
+ * decoder loads the images in order, the calling thread projects them with the worker
+ * pool, and an encoder writes the sinograms. The stages are connected by bounded
+ * queues, so at most a few slices are held in memory and decoding and encoding of the
+ * neighbouring slices overlap the projection. Everything derived from the geometry
+ * (scratch arena, system matrix) is set up once by the caller and shared by all slices.
+ */
+
+/* slices decoded ahead of, and sinograms waiting behind the projection */
+#define BATCH_QUEUE_LENGTH 4
+
+struct slice {
+    int index;
+    unsigned char* image;       /* NULL if the file could not be decoded */
+    int width, height, channels;
+    float* sinogram;
+};
+
+struct batch_stage {
+    struct batch_job* batch;
+    struct queue* queue;
+    pthread_t thread;
+    int failed;
+};
+
+static int is_image_file(const char* filename) {
+    static const char* extensions[] = { ".png", ".jpg", ".jpeg", ".bmp", ".tga", ".pgm", ".ppm", NULL };
+    const char* ext = strrchr(filename, '.');
+
+    if ( !ext ) return 0;
+    for (int i = 0; extensions[i]; i++) {
+        const char* a = ext;
+        const char* b = extensions[i];
+        /* case-insensitive compare, scanners like to write .PNG */
+        while ( *a && *b && (*a | 0x20) == *b ) { a++; b++; }
+        if ( !*a && !*b ) return 1;
+    }
+    return 0;
+}
+
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+/* append a copy of name to the growing list */
+static int add_slice(char*** filenames, int* count, int* capacity, const char* dir, const char* name) {
+    size_t len = (dir ? strlen(dir) + 1 : 0) + strlen(name) + 1;
+    char* filename;
+
+    if ( *count == *capacity ) {
+        int new_capacity = *capacity ? 2 * *capacity : 64;
+        char** grown = realloc(*filenames, new_capacity*sizeof(char*));
+        if ( !grown ) return -1;
+        *filenames = grown;
+        *capacity = new_capacity;
+    }
+    filename = malloc(len);
+    if ( !filename ) return -1;
+    if ( dir ) snprintf(filename, len, "%s/%s", dir, name);
+    else snprintf(filename, len, "%s", name);
+    (*filenames)[(*count)++] = filename;
+    return 0;
+}
+
+/* image files of directory path, NULL if it is not a directory */
+static char** list_directory(const char* path, int* count, int* capacity, int* is_dir) {
+    char** filenames = NULL;
+    *is_dir = 0;
+#ifdef _WIN32
+    WIN32_FIND_DATAA found;
+    char pattern[MAX_PATH];
+    HANDLE search;
+
+    snprintf(pattern, sizeof(pattern), "%s\\*", path);
+    search = FindFirstFileA(pattern, &found);
+    if ( search == INVALID_HANDLE_VALUE ) return NULL;
+    *is_dir = 1;
+    do {
+        if ( !(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && is_image_file(found.cFileName) ) {
+            if ( add_slice(&filenames, count, capacity, path, found.cFileName) != 0 ) break;
+        }
+    } while ( FindNextFileA(search, &found) );
+    FindClose(search);
+#else
+    DIR* dir = opendir(path);
+    struct dirent* entry;
+
+    if ( !dir ) return NULL;
+    *is_dir = 1;
+    while ( (entry = readdir(dir)) ) {
+        if ( entry->d_name[0] != '.' && is_image_file(entry->d_name) ) {
+            if ( add_slice(&filenames, count, capacity, path, entry->d_name) != 0 ) break;
+        }
+    }
+    closedir(dir);
+#endif
+    return filenames;
+}
+
+/* one filename per line, blank lines and lines starting with # are skipped */
+static char** list_file(const char* path, int* count, int* capacity) {
+    char** filenames = NULL;
+    char line[4096];
+    FILE* file = fopen(path, "r");
+
+    if ( !file ) return NULL;
+    while ( fgets(line, sizeof(line), file) ) {
+        size_t len = strcspn(line, "\r\n");
+        line[len] = '\0';
+        if ( len == 0 || line[0] == '#' ) continue;
+        if ( add_slice(&filenames, count, capacity, NULL, line) != 0 ) break;
+    }
+    fclose(file);
+    return filenames;
+}
+
+char** list_slices(const char* path, int* count) {
+    char** filenames;
+    int capacity = 0, is_dir;
+
+    *count = 0;
+    filenames = list_directory(path, count, &capacity, &is_dir);
+    if ( is_dir ) {
+        /* directory order is arbitrary, slices are numbered by name */
+        if ( filenames ) qsort(filenames, *count, sizeof(char*), compare_names);
+    }
+    else {
+        filenames = list_file(path, count, &capacity);
+    }
+    if ( filenames && *count == 0 ) {
+        free(filenames);
+        filenames = NULL;
+    }
+    return filenames;
+}
+
+void free_slices(char** filenames, int count) {
+    if ( !filenames ) return;
+    for (int i = 0; i < count; i++) {
+        free(filenames[i]);
+    }
+    free(filenames);
+}
+
+static const char* format_extension(enum SINOGRAM_FORMAT format) {
+    switch ( format ) {
+        case FORMAT_NPY16:
+        case FORMAT_NPY32: return ".npy";
+        case FORMAT_RAW32: return ".raw";
+        default:           return ".png";
+    }
+}
+
+/* output_dir/<input name without directory and extension><format extension> */
+static void output_filename(char* out, size_t size, struct batch_job* batch, const char* input_filename) {
+    const char* name = input_filename;
+    const char* ext;
+    int stem;
+
+    for (const char* p = input_filename; *p; p++) {
+        if ( *p == '/' || *p == '\\' ) name = p + 1;
+    }
+    ext = strrchr(name, '.');
+    stem = ext ? (int) (ext - name) : (int) strlen(name);
+    snprintf(out, size, "%s/%.*s%s", batch->output_dir, stem, name, format_extension(batch->format));
+}
+
+static void* decoder_main(void* arg) {
+    struct batch_stage* stage = arg;
+    struct batch_job* batch = stage->batch;
+
+    for (int i = 0; i < batch->count; i++) {
+        struct slice* slice = calloc(1, sizeof(*slice));
+        if ( !slice ) break;
+        slice->index = i;
+        TRACE_BEGIN(decode_time);
+        slice->image = stbi_load(batch->input_filenames[i], &slice->width, &slice->height, &slice->channels, 0);
+        TRACE_END(decode_time, "decode", i);
+        if ( !slice->image ) {
+            fprintf(stderr, "Cannot load %s: %s\n", batch->input_filenames[i], stbi_failure_reason());
+        }
+        if ( queue_push(stage->queue, slice) != 0 ) {
+            stbi_image_free(slice->image);
+            free(slice);
+            break;
+        }
+    }
+    queue_close(stage->queue);
+    return NULL;
+}
+
+static void* encoder_main(void* arg) {
+    struct batch_stage* stage = arg;
+    struct batch_job* batch = stage->batch;
+    struct slice* slice;
+    char filename[1024];
+
+    while ( (slice = queue_pop(stage->queue)) ) {
+        output_filename(filename, sizeof(filename), batch, batch->input_filenames[slice->index]);
+        TRACE_BEGIN(encode_time);
+        int status = write_sinogram(filename, slice->sinogram, batch->projection.angles, batch->projection.height_sin, slice->channels, batch->format);
+        TRACE_END(encode_time, "encode", slice->index);
+        if ( status == 0 ) {
+            printf("%s\n", filename);
+        }
+        else {
+            fprintf(stderr, "Cannot write %s\n", filename);
+            stage->failed++;
+        }
+        free(slice->sinogram);
+        free(slice);
+    }
+    return NULL;
+}
+
+int run_batch(struct batch_job* batch, struct thread_pool* pool) {
+    struct batch_stage decoder, encoder;
+    struct sinogram_job* geometry = &batch->projection;
+    struct slice* slice;
+    int failed = 0, decoding;
+
+    memset(&decoder, 0, sizeof(decoder));
+    memset(&encoder, 0, sizeof(encoder));
+    decoder.batch = encoder.batch = batch;
+    decoder.queue = queue_create(BATCH_QUEUE_LENGTH);
+    encoder.queue = queue_create(BATCH_QUEUE_LENGTH);
+    decoding = decoder.queue && encoder.queue && pthread_create(&decoder.thread, NULL, decoder_main, &decoder) == 0;
+    if ( !decoding || pthread_create(&encoder.thread, NULL, encoder_main, &encoder) != 0 ) {
+        fprintf(stderr, "Cannot start the batch decoder and encoder threads\n");
+        if ( decoding ) {
+            /* the decoder stops at its next push, then its queue gives back what it holds */
+            queue_close(decoder.queue);
+            pthread_join(decoder.thread, NULL);
+            while ( (slice = queue_pop(decoder.queue)) ) {
+                stbi_image_free(slice->image);
+                free(slice);
+            }
+        }
+        queue_destroy(decoder.queue);
+        queue_destroy(encoder.queue);
+        return batch->count;
+    }
+
+    while ( (slice = queue_pop(decoder.queue)) ) {
+        const char* filename = batch->input_filenames[slice->index];
+
+        /* the shared geometry only fits slices of the same size and channel count */
+        if ( slice->image && (slice->width != geometry->width || slice->height != geometry->height || slice->channels != geometry->channels) ) {
+            fprintf(stderr, "Skipping %s: %dx%d with %d channels, the batch is %dx%d with %d\n", filename, slice->width, slice->height, slice->channels, geometry->width, geometry->height, geometry->channels);
+            stbi_image_free(slice->image);
+            slice->image = NULL;
+        }
+        if ( slice->image ) {
+            slice->sinogram = calloc((long) geometry->angles*geometry->height_sin*slice->channels, sizeof(float));
+        }
+        if ( !slice->image || !slice->sinogram ) {
+            stbi_image_free(slice->image);
+            free(slice);
+            failed++;
+            continue;
+        }
+
+        TRACE_BEGIN(project_time);
+        if ( batch->matrix ) {
+            system_matrix_project(batch->matrix, slice->sinogram, slice->image, slice->channels, pool);
+        }
+        else {
+            struct sinogram_job job = *geometry;
+            job.input_image = slice->image;
+            job.sinogram = slice->sinogram;
+            project_all_angles(&job, pool);
+        }
+        TRACE_END(project_time, "project_slice", slice->index);
+        stbi_image_free(slice->image);
+        slice->image = NULL;
+
+        if ( queue_push(encoder.queue, slice) != 0 ) {
+            free(slice->sinogram);
+            free(slice);
+            failed++;
+        }
+    }
+
+    queue_close(encoder.queue);
+    pthread_join(decoder.thread, NULL);
+    pthread_join(encoder.thread, NULL);
+    queue_destroy(decoder.queue);
+    queue_destroy(encoder.queue);
+    return failed + encoder.failed;
+}
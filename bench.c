@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "stb/stb_image.h"
+#include "stb/stb_image_write.h"
+#include "sinogram.h"
+#include "threads.h"
+#include "phantom.h"
+
+/*
+ * Benchmark harness.
+ *
+ * Every scenario is the Shepp-Logan phantom rasterized at one size, so runs are
+ * reproducible without any input files and large sizes need no decoding. Each stage of the pipeline is timed on its own with the monotonic
+ * clock, after one warm-up run, and the median and 95th percentile of the repeats are
+ * written as JSON together with the stage throughput. Stages:
+ *
+ *   load            stbi_load of the phantom encoded as PNG (in memory)
+ *   rotate          rotate_image() for every angle on one thread, the 2D gather
+ *   rotate_shear    rotate_image_shear() of the same angles, three linear 1D shears
+ *   rotate_sinc     the same with the windowed sinc filter
+ *   project_rotate  the angle loop with the rotate projector on the worker pool
+ *   project_ray     the angle loop with the ray projector on the worker pool
+ *   write           write_sinogram() as PNG
+ *   reconstruct     filtered back-projection on the worker pool
+ */
+
+#define BENCH_OUTPUT "bench_sinogram.png"
+
+/* defined by the stb implementation in stb.c but not declared in the public part of its header */
+unsigned char* stbi_write_png_to_mem(const unsigned char* pixels, int stride_bytes, int x, int y, int n, int* out_len);
+
+struct bench_case {
+    int size, channels;
+    int angles, height_sin;
+    double angle_delta;
+    unsigned char* png;             /* encoded phantom */
+    int png_len;
+    unsigned char* image;
+    float* sinogram;
+    float* reconstruction;
+    struct scratch_arena* scratch;
+    struct thread_pool* pool;
+    double rotated_pixels;          /* work of the rotate stage */
+};
+
+typedef void (*stage_fn)(struct bench_case* bench);
+
+static void stage_load(struct bench_case* bench) {
+    int width, height, channels;
+    unsigned char* image = stbi_load_from_memory(bench->png, bench->png_len, &width, &height, &channels, 0);
+    stbi_image_free(image);
+}
+
+static void rotate_all(struct bench_case* bench, enum ROTATION rotation) {
+    unsigned char* rotated = scratch_slab(bench->scratch, 0);
+    float* shear_scratch = (float*) (rotated + shear_scratch_offset(bench->size, bench->size, bench->channels));
+    int width_rot, height_rot;
+
+    bench->rotated_pixels = 0.0;
+    for (int a = 0; a < bench->angles; a++) {
+        double angle_rad = a*bench->angle_delta * M_PI / 180.0;
+        size_of_rotated_image(&width_rot, &height_rot, bench->size, bench->size, angle_rad);
+        if ( rotation == ROTATION_GATHER ) {
+            rotate_image(rotated, bench->image, angle_rad, bench->size, bench->size, width_rot, height_rot, bench->channels, NEAREST);
+        }
+        else {
+            rotate_image_shear(rotated, bench->image, angle_rad, bench->size, bench->size, width_rot, height_rot, bench->channels, rotation, shear_scratch);
+        }
+        bench->rotated_pixels += (double) width_rot*height_rot;
+    }
+}
+
+static void stage_rotate(struct bench_case* bench) {
+    rotate_all(bench, ROTATION_GATHER);
+}
+
+static void stage_rotate_shear(struct bench_case* bench) {
+    rotate_all(bench, ROTATION_SHEAR);
+}
+
+static void stage_rotate_sinc(struct bench_case* bench) {
+    rotate_all(bench, ROTATION_SHEAR_SINC);
+}
+
+static void project(struct bench_case* bench, enum PROJECTOR projector) {
+    struct sinogram_job job = {
+        .input_image = bench->image, .width = bench->size, .height = bench->size, .channels = bench->channels,
+        .sinogram = bench->sinogram, .height_sin = bench->height_sin, .angles = bench->angles,
+        .angle_start = 0.0, .angle_delta = bench->angle_delta,
+        .projector = projector, .interp = NEAREST, .scratch = bench->scratch, .symmetry = 1
+    };
+    project_all_angles(&job, bench->pool);
+}
+
+static void stage_project_rotate(struct bench_case* bench) {
+    project(bench, PROJECT_ROTATE);
+}
+
+static void stage_project_ray(struct bench_case* bench) {
+    project(bench, PROJECT_RAY);
+}
+
+static void stage_write(struct bench_case* bench) {
+    write_sinogram(BENCH_OUTPUT, bench->sinogram, bench->angles, bench->height_sin, bench->channels, FORMAT_PNG8);
+}
+
+static void stage_reconstruct(struct bench_case* bench) {
+    /* the sinogram left by the project_ray stage */
+    if ( reconstruct_fbp(bench->reconstruction, bench->size, bench->size, bench->sinogram, bench->angles, bench->height_sin, bench->channels, 0.0, bench->angle_delta, FILTER_SHEPP_LOGAN, PROJECT_RAY, bench->pool) != 0 ) {
+        fprintf(stderr, "Cannot allocate the filtered back-projection buffers\n");
+        exit(1);
+    }
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return x < y ? -1 : x > y;
+}
+
+/* one warm-up, then repeat timed runs, samples come back sorted */
+static void time_stage(struct bench_case* bench, stage_fn stage, int repeat, double* samples) {
+    stage(bench);
+    for (int r = 0; r < repeat; r++) {
+        double start = monotonic_seconds();
+        stage(bench);
+        samples[r] = monotonic_seconds() - start;
+    }
+    qsort(samples, repeat, sizeof(double), compare_doubles);
+}
+
+static double median(const double* sorted, int n) {
+    return n % 2 ? sorted[n/2] : 0.5*(sorted[n/2 - 1] + sorted[n/2]);
+}
+
+/* nearest rank */
+static double percentile(const double* sorted, int n, double p) {
+    int rank = (int) ceil(p*n);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void usage(const char* program) {
+    printf("Usage: %s [options]\n"
+           "      --sizes N,N,...   phantom sizes (default 128,256,512)\n"
+           "      --channels N      phantom channels (default 1)\n"
+           "      --angle-step DEG  angle increment over a full turn (default 2)\n"
+           "      --repeat N        timed runs per stage after one warm-up (default 5)\n"
+           "  -j, --threads N       worker threads (default all CPUs)\n"
+           "  -o, --output FILE     JSON results (default standard output)\n"
+           "  -h, --help            show this help\n", program);
+}
+
+int main(int argc, char** argv) {
+    static const struct { const char* name; stage_fn run; const char* unit; } stages[] = {
+        { "load",           stage_load,           "pixels/s" },
+        { "rotate",         stage_rotate,         "pixels/s" },
+        { "rotate_shear",   stage_rotate_shear,   "pixels/s" },
+        { "rotate_sinc",    stage_rotate_sinc,    "pixels/s" },
+        { "project_rotate", stage_project_rotate, "bins/s" },
+        { "project_ray",    stage_project_ray,    "bins/s" },
+        { "write",          stage_write,          "bins/s" },
+        { "reconstruct",    stage_reconstruct,    "pixels/s" },
+    };
+    const char* sizes = "128,256,512";
+    const char* output_filename = NULL;
+    int channels = 1, repeat = 5, threads = cpu_count();
+    double angle_delta = 2.0;
+    FILE* out = stdout;
+    int first = 1;
+
+    for (int i = 1; i < argc; i++) {
+        const char* value = i+1 < argc ? argv[i+1] : NULL;
+        if ( strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0 ) { usage(argv[0]); return 0; }
+        if ( !value ) { fprintf(stderr, "Unknown option or missing value %s, see --help\n", argv[i]); return 1; }
+        if ( strcmp(argv[i], "--sizes") == 0 ) sizes = value;
+        else if ( strcmp(argv[i], "--channels") == 0 ) channels = atoi(value);
+        else if ( strcmp(argv[i], "--angle-step") == 0 ) angle_delta = atof(value);
+        else if ( strcmp(argv[i], "--repeat") == 0 ) repeat = atoi(value);
+        else if ( strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--threads") == 0 ) threads = atoi(value);
+        else if ( strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--output") == 0 ) output_filename = value;
+        else { fprintf(stderr, "Unknown option %s, see --help\n", argv[i]); return 1; }
+        i++;
+    }
+    if ( channels < 1 || channels > NUM_CHANNELS || repeat < 1 || angle_delta <= 0.0 ) {
+        fprintf(stderr, "Bad channels, repeat or angle step\n");
+        return 1;
+    }
+    if ( threads < 1 ) threads = 1;
+    if ( output_filename && !(out = fopen(output_filename, "w")) ) {
+        fprintf(stderr, "Cannot write %s\n", output_filename);
+        return 1;
+    }
+
+    struct thread_pool* pool = pool_create(threads);
+    struct phantom* phantom = phantom_named("shepp-logan");
+    double* samples = malloc(repeat*sizeof(double));
+    int angles = (int) ceil(360.0 / angle_delta - 1e-9);
+
+    fprintf(out, "{\n  \"threads\": %d, \"channels\": %d, \"angles\": %d, \"repeat\": %d,\n  \"results\": [\n", pool_size(pool), channels, angles, repeat);
+    fprintf(stderr, "%6s %-16s %12s %12s %14s\n", "size", "stage", "median ms", "p95 ms", "throughput");
+
+    for (const char* p = sizes; *p; ) {
+        struct bench_case bench;
+        int size = atoi(p);
+
+        p += strcspn(p, ",");
+        if ( *p == ',' ) p++;
+        if ( size <= 0 ) continue;
+
+        memset(&bench, 0, sizeof(bench));
+        bench.size = size;
+        bench.channels = channels;
+        bench.angles = angles;
+        bench.angle_delta = angle_delta;
+        bench.height_sin = (int) sqrt(2.0*size*size);
+        bench.pool = pool;
+        bench.image = malloc((size_t) size*size*channels);
+        if ( !bench.image || phantom_rasterize_u8(phantom, bench.image, size, size, channels, 1) != 0 ) {
+            fprintf(stderr, "Cannot allocate the %dx%d phantom\n", size, size);
+            return 1;
+        }
+        bench.png = stbi_write_png_to_mem(bench.image, size*channels, size, size, channels, &bench.png_len);
+        bench.sinogram = calloc((size_t) angles*bench.height_sin*channels, sizeof(float));
+        bench.reconstruction = malloc((size_t) size*size*channels*sizeof(float));
+        bench.scratch = scratch_create(pool_size(pool), rotation_scratch_bound(size, size, channels, ROTATION_SHEAR));
+
+        for (size_t s = 0; s < sizeof(stages) / sizeof(stages[0]); s++) {
+            double work;
+
+            time_stage(&bench, stages[s].run, repeat, samples);
+            if ( strncmp(stages[s].name, "rotate", 6) == 0 ) work = bench.rotated_pixels;
+            else if ( strcmp(stages[s].unit, "bins/s") == 0 ) work = (double) angles*bench.height_sin;
+            else work = (double) size*size;
+
+            double med = median(samples, repeat), p95 = percentile(samples, repeat, 0.95);
+            fprintf(out, "%s    { \"size\": %d, \"stage\": \"%s\", \"median_ms\": %.4f, \"p95_ms\": %.4f, \"min_ms\": %.4f, \"throughput\": %.6g, \"unit\": \"%s\" }",
+                    first ? "" : ",\n", size, stages[s].name, 1e3*med, 1e3*p95, 1e3*samples[0], work / med, stages[s].unit);
+            fprintf(stderr, "%6d %-16s %12.3f %12.3f %10.4g %s\n", size, stages[s].name, 1e3*med, 1e3*p95, work / med, stages[s].unit);
+            first = 0;
+        }
+
+        scratch_destroy(bench.scratch);
+        free(bench.reconstruction);
+        free(bench.sinogram);
+        free(bench.png);
+        free(bench.image);
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    remove(BENCH_OUTPUT);
+    phantom_destroy(phantom);
+    release_filter_spectra();
+    free(samples);
+    pool_destroy(pool);
+    if ( out != stdout ) fclose(out);
+    return 0;
+}
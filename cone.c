@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sinogram.h"
+#include "threads.h"
+#include "volume.h"
+
+/*
+ * Cone-beam projector.
+ *
+ * The source circles the volume's z axis in the plane z = 0 like the fan-beam source,
+ * and a flat detector of det_rows x det_cols bins faces it; its columns run along the
+ * fan-beam detector axis and its rows along z. Every bin is one ray from the source,
+ * clipped to the volume box and sampled every CONE_STEP voxels with trilinear
+ * interpolation, the 3D version of bilinear_interp().
+ *
+ * The volume is held in bricks of BRICK^3 voxels, so the eight taps of a sample and the
+ * samples of neighbouring rays, which go in about the same direction, mostly fall in the
+ * same few bricks. Each angle's detector is split into CONE_TILE^2 tiles handed to the
+ * worker pool; the rays of a tile are neighbours and sweep the same bricks together.
+ */
+
+#define BRICK_SHIFT 3
+#define BRICK (1 << BRICK_SHIFT)
+#define BRICK_MASK (BRICK - 1)
+
+/* detector bins per tile edge */
+#define CONE_TILE 16
+
+/* sample spacing along a ray, in voxels */
+#define CONE_STEP 0.5
+
+static long brick_index(const struct brick_volume* volume, int x, int y, int z) {
+    long brick = ((long) (z >> BRICK_SHIFT)*volume->bricks_y + (y >> BRICK_SHIFT))*volume->bricks_x + (x >> BRICK_SHIFT);
+    return (brick << 3*BRICK_SHIFT) + ((z & BRICK_MASK) << 2*BRICK_SHIFT) + ((y & BRICK_MASK) << BRICK_SHIFT) + (x & BRICK_MASK);
+}
+
+struct brick_volume* brick_volume_load(struct volume_source* volume) {
+    struct brick_volume* bricks = calloc(1, sizeof(*bricks));
+    size_t voxels = (size_t) volume->width*volume->height;
+    float* slab;
+    int count;
+
+    if ( !bricks ) return NULL;
+    bricks->width = volume->width;
+    bricks->height = volume->height;
+    bricks->depth = volume->depth;
+    bricks->bricks_x = (volume->width + BRICK_MASK) >> BRICK_SHIFT;
+    bricks->bricks_y = (volume->height + BRICK_MASK) >> BRICK_SHIFT;
+    bricks->bricks_z = (volume->depth + BRICK_MASK) >> BRICK_SHIFT;
+
+    /* padding voxels of partial bricks stay zero */
+    bricks->voxels = calloc((size_t) bricks->bricks_x*bricks->bricks_y*bricks->bricks_z << 3*BRICK_SHIFT, sizeof(float));
+    slab = malloc(BRICK*voxels*sizeof(float));
+    if ( !bricks->voxels || !slab ) {
+        free(slab);
+        brick_volume_destroy(bricks);
+        return NULL;
+    }
+
+    /* one layer of bricks at a time */
+    for (int z0 = 0; z0 < volume->depth; z0 += BRICK) {
+        count = volume_read_slices(volume, slab, BRICK);
+        if ( count < BRICK && z0 + count < volume->depth ) {
+            fprintf(stderr, "Volume ends after %d of %d slices\n", z0 + count, volume->depth);
+            free(slab);
+            brick_volume_destroy(bricks);
+            return NULL;
+        }
+        for (int z = 0; z < count; z++) {
+            for (int y = 0; y < volume->height; y++) {
+                const float* in = slab + z*voxels + (size_t) y*volume->width;
+                for (int x = 0; x < volume->width; x++) {
+                    bricks->voxels[brick_index(bricks, x, y, z0 + z)] = in[x];
+                }
+            }
+        }
+    }
+    free(slab);
+    return bricks;
+}
+
+void brick_volume_destroy(struct brick_volume* bricks) {
+    if ( !bricks ) return;
+    free(bricks->voxels);
+    free(bricks);
+}
+
+static float voxel_or_zero(const struct brick_volume* volume, int x, int y, int z) {
+    if ( x < 0 || y < 0 || z < 0 || x >= volume->width || y >= volume->height || z >= volume->depth ) return 0.0f;
+    return volume->voxels[brick_index(volume, x, y, z)];
+}
+
+float trilinear_sample(const struct brick_volume* volume, double x, double y, double z) {
+    int x0 = (int) floor(x), y0 = (int) floor(y), z0 = (int) floor(z);
+    float fx = (float) (x - x0), fy = (float) (y - y0), fz = (float) (z - z0);
+    float c000, c100, c010, c110, c001, c101, c011, c111;
+
+    if ( x0 >= 0 && y0 >= 0 && z0 >= 0 && x0 + 1 < volume->width && y0 + 1 < volume->height && z0 + 1 < volume->depth ) {
+        /* all eight taps inside, no bounds checks */
+        const float* v = volume->voxels;
+        c000 = v[brick_index(volume, x0, y0, z0)];         c100 = v[brick_index(volume, x0 + 1, y0, z0)];
+        c010 = v[brick_index(volume, x0, y0 + 1, z0)];     c110 = v[brick_index(volume, x0 + 1, y0 + 1, z0)];
+        c001 = v[brick_index(volume, x0, y0, z0 + 1)];     c101 = v[brick_index(volume, x0 + 1, y0, z0 + 1)];
+        c011 = v[brick_index(volume, x0, y0 + 1, z0 + 1)]; c111 = v[brick_index(volume, x0 + 1, y0 + 1, z0 + 1)];
+    }
+    else {
+        /* the volume is zero outside, like the 2D samplers' black border */
+        c000 = voxel_or_zero(volume, x0, y0, z0);         c100 = voxel_or_zero(volume, x0 + 1, y0, z0);
+        c010 = voxel_or_zero(volume, x0, y0 + 1, z0);     c110 = voxel_or_zero(volume, x0 + 1, y0 + 1, z0);
+        c001 = voxel_or_zero(volume, x0, y0, z0 + 1);     c101 = voxel_or_zero(volume, x0 + 1, y0, z0 + 1);
+        c011 = voxel_or_zero(volume, x0, y0 + 1, z0 + 1); c111 = voxel_or_zero(volume, x0 + 1, y0 + 1, z0 + 1);
+    }
+
+    float c00 = c000 + fx*(c100 - c000), c10 = c010 + fx*(c110 - c010);
+    float c01 = c001 + fx*(c101 - c001), c11 = c011 + fx*(c111 - c011);
+    float c0 = c00 + fy*(c10 - c00), c1 = c01 + fy*(c11 - c01);
+    return c0 + fz*(c1 - c0);
+}
+
+/* parameter range [t_enter, t_exit] of the ray p + t*dir inside [lo, hi] on one axis */
+static int clip_axis(double p, double dir, double lo, double hi, double* t_enter, double* t_exit) {
+    if ( dir == 0.0 ) return p >= lo && p <= hi;
+
+    double t0 = (lo - p) / dir, t1 = (hi - p) / dir;
+    if ( t0 > t1 ) { double tmp = t0; t0 = t1; t1 = tmp; }
+    if ( t0 > *t_enter ) *t_enter = t0;
+    if ( t1 < *t_exit ) *t_exit = t1;
+    return *t_enter <= *t_exit;
+}
+
+/* line integral through the volume from (px,py,pz) along the unit vector (dx,dy,dz), voxel index coordinates */
+static float cone_ray(const struct brick_volume* volume, double px, double py, double pz, double dx, double dy, double dz) {
+    double t_enter = 0.0, t_exit = HUGE_VAL;
+    float sum = 0.0f;
+
+    /* voxel centers are at integer coordinates, the box spans half a voxel beyond them */
+    if ( !clip_axis(px, dx, -0.5, volume->width - 0.5, &t_enter, &t_exit) ) return 0.0f;
+    if ( !clip_axis(py, dy, -0.5, volume->height - 0.5, &t_enter, &t_exit) ) return 0.0f;
+    if ( !clip_axis(pz, dz, -0.5, volume->depth - 0.5, &t_enter, &t_exit) ) return 0.0f;
+
+    for (double t = t_enter + 0.5*CONE_STEP; t < t_exit; t += CONE_STEP) {
+        sum += trilinear_sample(volume, px + t*dx, py + t*dy, pz + t*dz);
+    }
+    return sum * (float) CONE_STEP;
+}
+
+void cone_detector_size(const struct fan_geometry* cone, int width, int height, int depth, int* det_cols, int* det_rows) {
+    double radius = 0.5*sqrt((double) width*width + (double) height*height);
+
+    if ( *det_cols <= 0 ) *det_cols = fan_detectors(cone, width, height);
+    /* the volume's top and bottom edges are magnified most where they are nearest the source */
+    if ( *det_rows <= 0 ) *det_rows = 2 * (int) ceil(0.5*depth * cone->sdd / (cone->sid - radius) / cone->spacing);
+}
+
+struct cone_job {
+    const struct brick_volume* volume;
+    const struct fan_geometry* cone;
+    int det_cols, det_rows;
+    int tiles_x, tiles_y;
+    double cos_a, sin_a;
+    float* projection;              /* det_rows x det_cols of the current angle */
+};
+
+static void cone_task(void* ctx, int item, int thread) {
+    struct cone_job* job = ctx;
+    const struct brick_volume* volume = job->volume;
+    const struct fan_geometry* cone = job->cone;
+    int col0 = (item % job->tiles_x) * CONE_TILE;
+    int row0 = (item / job->tiles_x) * CONE_TILE;
+    int col1 = col0 + CONE_TILE < job->det_cols ? col0 + CONE_TILE : job->det_cols;
+    int row1 = row0 + CONE_TILE < job->det_rows ? row0 + CONE_TILE : job->det_rows;
+    (void) thread;
+
+    /* source in voxel index coordinates */
+    double px = -cone->sid*job->cos_a + 0.5*volume->width - 0.5;
+    double py = -cone->sid*job->sin_a + 0.5*volume->height - 0.5;
+    double pz = 0.5*volume->depth - 0.5;
+
+    for (int row = row0; row < row1; row++) {
+        double v = (row + 0.5 - 0.5*job->det_rows) * cone->spacing;
+        for (int col = col0; col < col1; col++) {
+            double u = (col + 0.5 - 0.5*job->det_cols) * cone->spacing;
+
+            /* towards bin (u,v) of the flat detector, sdd from the source */
+            double dx = cone->sdd*job->cos_a - u*job->sin_a;
+            double dy = cone->sdd*job->sin_a + u*job->cos_a;
+            double dz = v;
+            double len = sqrt(dx*dx + dy*dy + dz*dz);
+
+            job->projection[(long) row*job->det_cols + col] = cone_ray(volume, px, py, pz, dx/len, dy/len, dz/len);
+        }
+    }
+}
+
+int project_cone(const struct brick_volume* volume, const char* filename, enum SINOGRAM_FORMAT format, const struct fan_geometry* cone, int det_cols, int det_rows, int angles, double angle_start, double angle_delta, struct thread_pool* pool, double* rays_per_second) {
+    struct cone_job job;
+    size_t len = (size_t) det_cols*det_rows;
+    double seconds = 0.0;
+    FILE* file;
+    int ok = 1;
+
+    memset(&job, 0, sizeof(job));
+    job.volume = volume;
+    job.cone = cone;
+    job.det_cols = det_cols;
+    job.det_rows = det_rows;
+    job.tiles_x = (det_cols + CONE_TILE-1) / CONE_TILE;
+    job.tiles_y = (det_rows + CONE_TILE-1) / CONE_TILE;
+    job.projection = malloc(len*sizeof(float));
+    file = fopen(filename, "wb");
+    if ( !job.projection || !file ) {
+        if ( file ) fclose(file);
+        free(job.projection);
+        return -1;
+    }
+
+    if ( format == FORMAT_NPY32 ) {
+        long long shape[3] = { angles, det_rows, det_cols };
+        write_npy_header(file, "f4", 3, shape);
+    }
+
+    for (int a = 0; a < angles && ok; a++) {
+        double angle_rad = (angle_start + a*angle_delta) * M_PI / 180.0;
+        double start = monotonic_seconds();
+
+        job.cos_a = cos(angle_rad);
+        job.sin_a = sin(angle_rad);
+        pool_run(pool, job.tiles_x*job.tiles_y, cone_task, &job);
+        seconds += monotonic_seconds() - start;
+
+        ok = fwrite(job.projection, sizeof(float), len, file) == len;
+    }
+
+    if ( fclose(file) != 0 ) ok = 0;
+    free(job.projection);
+    /* projection time only, file output excluded */
+    if ( rays_per_second ) *rays_per_second = seconds > 0.0 ? (double) angles*len / seconds : 0.0;
+    return ok ? 0 : -1;
+}
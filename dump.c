@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "stb/stb_image_write.h"
+#include "sinogram.h"
+#include "threads.h"
+#include "trace.h"
+
+/*
+ * Asynchronous debug output.
+ *
+ * Rotated images are copied into a bounded queue and written as PNG by a background
+ * thread, so deflate no longer runs inside the angle loop. When the writer falls
+ * behind by more than the queue capacity, dump_image() waits, which also bounds the
+ * memory held by pending images.
+ */
+
+struct dump_item {
+    char filename[64];
+    int width, height, channels;
+    unsigned char pixels[];
+};
+
+struct dump_writer {
+    struct queue* queue;
+    pthread_t thread;
+    int previous_level;
+};
+
+static void* writer_main(void* arg) {
+    struct dump_writer* writer = arg;
+    struct dump_item* item;
+
+    for (int index = 0; (item = queue_pop(writer->queue)); index++) {
+        TRACE_BEGIN(png_time);
+        int ok = stbi_write_png(item->filename, item->width, item->height, item->channels, item->pixels, item->width*item->channels);
+        TRACE_END(png_time, "dump_png", index);
+        if ( ok ) {
+            printf("%s\n", item->filename);
+        }
+        else {
+            fprintf(stderr, "Cannot write %s\n", item->filename);
+        }
+        free(item);
+    }
+    return NULL;
+}
+
+struct dump_writer* dump_writer_create(int capacity, int compression_level) {
+    struct dump_writer* writer = calloc(1, sizeof(*writer));
+    if ( !writer ) return NULL;
+
+    /* stb keeps the level in a global, it is restored when the writer is destroyed */
+    writer->previous_level = stbi_write_png_compression_level;
+    stbi_write_png_compression_level = compression_level;
+
+    writer->queue = queue_create(capacity);
+    if ( !writer->queue || pthread_create(&writer->thread, NULL, writer_main, writer) != 0 ) {
+        queue_destroy(writer->queue);
+        stbi_write_png_compression_level = writer->previous_level;
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+void dump_image(struct dump_writer* writer, const char* filename, unsigned char* image, int width, int height, int channels) {
+    size_t size = (size_t) width*height*channels;
+    struct dump_item* item = malloc(sizeof(*item) + size);
+    if ( !item ) return;
+
+    snprintf(item->filename, sizeof(item->filename), "%s", filename);
+    item->width = width;
+    item->height = height;
+    item->channels = channels;
+    memcpy(item->pixels, image, size);
+
+    if ( queue_push(writer->queue, item) != 0 ) {
+        free(item);
+    }
+}
+
+void dump_writer_destroy(struct dump_writer* writer) {
+    if ( !writer ) return;
+
+    /* let the writer drain what is queued */
+    queue_close(writer->queue);
+    pthread_join(writer->thread, NULL);
+    queue_destroy(writer->queue);
+    stbi_write_png_compression_level = writer->previous_level;
+    free(writer);
+}
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sinogram.h"
+#include "threads.h"
+#include "trace.h"
+
+/*
+ * Angle loop.
+ *
+ * The sinogram is kept projection-major, so every angle only writes its own contiguous
+ * block of height_sin x channels values. Angles are independent and are spread over the
+ * worker pool without any locking or false sharing between neighbouring columns. Each worker rotates into its own
+ * slab of the scratch arena, allocated once for the largest rotated image, and
+ * rotate_image() writes every pixel of it, so slabs are never cleared in between.
+ * With job->rotation set to a shear, rotate_image_shear() writes the same rotated image
+ * and keeps its float planes in the rest of the slab.
+ *
+ * Parallel-beam projections repeat: the one at angle+180 is the one at angle with the
+ * detector reversed. With job->symmetry set, the ray projector pairs angles that far
+ * apart, projects the first of each pair and mirrors it into the other. Its detector
+ * bins are placed symmetrically about the center, so the mirror is exact. The rotate
+ * projector's grid is centered on a pixel corner, and its angle+180 samples a row and
+ * column the rotated image at angle does not have, so it always projects every angle.
+ *
+ * At multiples of 90 degrees the rotate projector does not rotate at all: the rotated
+ * grid is the input grid reindexed, and project_quarter_turn() sums input rows or
+ * columns directly.
+ */
+
+/* an angle and the one 180 degrees on, -1 if that is not projected */
+struct angle_pair {
+    int angle, opposite;
+};
+
+struct pair_job {
+    struct sinogram_job* job;
+    struct angle_pair* pairs;
+};
+
+static void angle_task(void* ctx, int item, int thread) {
+    struct sinogram_job* job = ctx;
+    project_angle(job, item, thread);
+}
+
+/* multiple of 90 degrees the rotate projector can take without rotating, or -1 */
+static int quarter_turns(struct sinogram_job* job, double angle_deg) {
+    double turns = floor(angle_deg / 90.0 + 0.5);
+
+    /* dumps want the rotated image; bilinear only lands on whole pixels for even sizes */
+    if ( job->projector != PROJECT_ROTATE || job->dumps ) return -1;
+    if ( job->interp != NEAREST && (job->width % 2 || job->height % 2) ) return -1;
+    if ( fabs(angle_deg - 90.0*turns) > 1e-9 ) return -1;
+    return (int) fmod(fmod(turns, 4.0) + 4.0, 4.0);
+}
+
+size_t rotated_image_bound(int width, int height, int channels) {
+    /* size_of_rotated_image() rounds half the rotated extent, which is at most half the diagonal */
+    size_t side = (size_t) ceil(sqrt((double) width*width + (double) height*height)) + 2;
+    return side*side*channels;
+}
+
+/* the shear buffers follow the rotated image, from the next cache line */
+size_t shear_scratch_offset(int width, int height, int channels) {
+    return (rotated_image_bound(width, height, channels) + 63) / 64 * 64;
+}
+
+size_t rotation_scratch_bound(int width, int height, int channels, enum ROTATION rotation) {
+    if ( rotation == ROTATION_GATHER ) return rotated_image_bound(width, height, channels);
+    return shear_scratch_offset(width, height, channels) + shear_scratch_bound(width, height, channels);
+}
+
+void project_angle(struct sinogram_job* job, int angle_index, int thread) {
+    int width_rot = 0, height_rot = 0;
+    double angle_deg = job->angle_start + angle_index*job->angle_delta;
+    double angle_rad;
+    char output_filename[64];
+    float* projection = job->sinogram + (long) angle_index*job->height_sin*job->channels;
+    TRACE_BEGIN(angle_time);
+
+    /* convert to radians */
+    angle_rad = angle_deg * M_PI / 180.0;
+
+    /* integrate rays directly through the input image, no rotated image is needed */
+    if ( job->projector == PROJECT_RAY ) {
+        project_rays(projection, job->height_sin, job->input_image, job->width, job->height, job->channels, angle_rad);
+        TRACE_END(angle_time, "project_rays", angle_index);
+        return;
+    }
+    if ( job->projector == PROJECT_FAN ) {
+        project_fan(projection, job->height_sin, job->input_image, job->width, job->height, job->channels, angle_rad, &job->fan);
+        TRACE_END(angle_time, "project_fan", angle_index);
+        return;
+    }
+
+    /* row or column sums of the input image */
+    int turns = quarter_turns(job, angle_deg);
+    if ( turns >= 0 ) {
+        project_quarter_turn(projection, job->height_sin, job->input_image, job->width, job->height, job->channels,
+                             turns, scratch_slab(job->scratch, thread));
+        TRACE_END(angle_time, "quarter_turn", angle_index);
+        return;
+    }
+
+    /* compute size of rotated image */
+    size_of_rotated_image(&width_rot, &height_rot, job->height, job->width, angle_rad);
+
+    /* this worker's slab of the scratch arena */
+    unsigned char* rotated_image = scratch_slab(job->scratch, thread);
+
+    /* rotate all image channels together */
+    TRACE_BEGIN(rotate_time);
+    if ( job->rotation == ROTATION_GATHER ) {
+        rotate_image(rotated_image, job->input_image, angle_rad, job->width, job->height, width_rot, height_rot, job->channels, job->interp);
+        TRACE_END(rotate_time, "rotate_image", angle_index);
+    }
+    else {
+        float* shear_scratch = (float*) (rotated_image + shear_scratch_offset(job->width, job->height, job->channels));
+        rotate_image_shear(rotated_image, job->input_image, angle_rad, job->width, job->height, width_rot, height_rot, job->channels, job->rotation, shear_scratch);
+        TRACE_END(rotate_time, "rotate_image_shear", angle_index);
+    }
+
+    /* fill sinogram with current rotated image */
+    TRACE_BEGIN(fill_time);
+    fill_sinogram(projection, job->height_sin, rotated_image, width_rot, height_rot, job->channels);
+    TRACE_END(fill_time, "fill_sinogram", angle_index);
+
+    /* hand rotated image over to the background writer */
+    if ( job->dumps ) {
+        sprintf(output_filename, "rotated%g.png", angle_deg);
+        dump_image(job->dumps, output_filename, rotated_image, width_rot, height_rot, job->channels);
+    }
+    TRACE_END(angle_time, "angle", angle_index);
+}
+
+/* index of the angle degrees on from angle index, if it is one of the job's angles and still free */
+static int find_angle(struct sinogram_job* job, const char* grouped, int index, double degrees) {
+    double target = job->angle_start + index*job->angle_delta + degrees;
+
+    /* the same direction may come up again after any number of full turns */
+    for (; target >= job->angle_start - 1e-9; target -= 360.0) {
+        double n = (target - job->angle_start) / job->angle_delta;
+        double nearest = floor(n + 0.5);
+        if ( fabs(n - nearest) < 1e-6 && nearest < job->angles && !grouped[(int) nearest] ) return (int) nearest;
+    }
+    return -1;
+}
+
+/* pairs of angles 180 degrees apart, returns the number of pairs or -1 if out of memory */
+static int pair_angles(struct sinogram_job* job, struct angle_pair* pairs) {
+    char* paired = calloc(job->angles, 1);
+    int count = 0;
+
+    if ( !paired ) return -1;
+    for (int i = 0; i < job->angles; i++) {
+        struct angle_pair* pair = &pairs[count];
+        if ( paired[i] ) continue;
+
+        paired[i] = 1;
+        pair->angle = i;
+        pair->opposite = find_angle(job, paired, i, 180.0);
+        if ( pair->opposite >= 0 ) paired[pair->opposite] = 1;
+        count++;
+    }
+    free(paired);
+    return count;
+}
+
+static float* projection_of(struct sinogram_job* job, int angle_index) {
+    return job->sinogram + (long) angle_index*job->height_sin*job->channels;
+}
+
+static void pair_task(void* ctx, int item, int thread) {
+    struct pair_job* pairs = ctx;
+    struct sinogram_job* job = pairs->job;
+    const struct angle_pair* pair = &pairs->pairs[item];
+
+    project_angle(job, pair->angle, thread);
+    if ( pair->opposite < 0 ) return;
+
+    /* the same rays the other way round: bin d is bin height_sin-1-d */
+    TRACE_BEGIN(derive_time);
+    const float* in = projection_of(job, pair->angle);
+    float* out = projection_of(job, pair->opposite);
+    for (int det = 0; det < job->height_sin; det++) {
+        memcpy(out + (long) det*job->channels, in + (long) (job->height_sin-1 - det)*job->channels, job->channels*sizeof(float));
+    }
+    TRACE_END(derive_time, "derive", pair->angle);
+}
+
+void project_all_angles(struct sinogram_job* job, struct thread_pool* pool) {
+    /* only the ray projector's detector is symmetric about the center */
+    if ( job->symmetry && job->projector == PROJECT_RAY ) {
+        struct pair_job pairs;
+        int count;
+
+        pairs.job = job;
+        pairs.pairs = malloc(job->angles*sizeof(struct angle_pair));
+        count = pairs.pairs ? pair_angles(job, pairs.pairs) : -1;
+        if ( count >= 0 ) {
+            pool_run(pool, count, pair_task, &pairs);
+            free(pairs.pairs);
+            return;
+        }
+        free(pairs.pairs);
+    }
+    pool_run(pool, job->angles, angle_task, job);
+}
@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "sinogram.h"
+#include "threads.h"
+#include "fft.h"
+
+/*
+ * Filtered back-projection.
+ *
+ * Inverse of the forward path: every projection (sinogram column) is convolved with a
+ * ramp filter and smeared back across the image along its rays. The geometry follows
+ * the projector that made the sinogram. The ray projector samples pixel centers on a
+ * detector centered on the sinogram middle row: pixel (i,j) at centered position
+ * (x,y) = (i + 0.5 - width/2, j + 0.5 - height/2) lies on detector bin
+ * d = -x*sin + y*cos + height_sin/2 - 0.5 of the projection taken at that angle.
+ * The rotate projector samples the input at grid corners, rotated about (width/2,
+ * height/2), and fill_sinogram() places row r of the rotated image at bin
+ * r + (height_sin - height_rot)/2: pixel (i,j) at (x,y) = (i - width/2, j - height/2)
+ * lies on bin d = -x*sin + y*cos + height_rot/2 + (height_sin - height_rot)/2, with
+ * height_rot from size_of_rotated_image() for that angle.
+ *
+ * Sinogram values are line integrals of the pixel values, so a round trip reconstructs
+ * the original pixel values.
+ *
+ * Projections are filtered in the frequency domain: the filter spectrum for a detector
+ * length is computed once and cached, and two real projections share one complex FFT
+ * (one in the real, one in the imaginary part), which works because the spectrum of a
+ * symmetric kernel is real. Filtering runs over the worker pool in batches of
+ * projections, back-projection by image row; each row accumulates all angles in a
+ * private buffer, so no locking is needed.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FBP_X86 1
+#include <immintrin.h>
+#else
+#define FBP_X86 0
+#endif
+
+/* projections filtered by one task */
+#define FILTER_BATCH 8
+
+/* zero padded transform of the filter kernel for one detector length */
+struct filter_spectrum {
+    int length;
+    enum FILTER filter;
+    struct fft_plan* plan;
+    float* response;    /* real spectrum, plan->n values */
+    struct filter_spectrum* next;
+};
+
+static struct filter_spectrum* spectrum_cache = NULL;
+static pthread_mutex_t spectrum_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* accumulate count samples of a zero padded projection, taken at u0, u0 + du, ... */
+typedef void (*backproject_row_fn)(float* row, const float* projection, int length, float u0, float du, int count);
+
+struct fbp_job {
+    /* filtered projections: channels x angles x (height_sin + 2), one zero on each side */
+    float* projections;
+    int stride;
+    struct filter_spectrum* spectrum;
+    float** scratch;
+    double* cos_a;
+    double* sin_a;
+    double* center;     /* detector position of the image center per angle, +1 for the zero padding */
+    double pixel;       /* 0.5 for pixel centers (ray projector), 0 for grid corners (rotate projector) */
+    float scale;
+
+    float* image;
+    int width, height, channels;
+    int angles, height_sin;
+
+    backproject_row_fn backproject_row;
+};
+
+/* Ram-Lak kernel for unit detector spacing (band-limited ramp) */
+static double ram_lak(int n) {
+    if ( n == 0 ) return 0.25;
+    if ( n % 2 == 0 ) return 0.0;
+    return -1.0 / (M_PI*M_PI*n*n);
+}
+
+void filter_kernel(float* kernel, int height_sin, enum FILTER filter) {
+    for (int n = -(height_sin-1); n <= height_sin-1; n++) {
+        double h;
+        switch ( filter ) {
+        case FILTER_SHEPP_LOGAN:
+            h = -2.0 / (M_PI*M_PI*(4.0*n*n - 1.0));
+            break;
+        case FILTER_HANN:
+            /* ramp times 0.5 + 0.5*cos(2 pi f) is the ramp kernel smoothed by (1/4, 1/2, 1/4) */
+            h = 0.5*ram_lak(n) + 0.25*(ram_lak(n-1) + ram_lak(n+1));
+            break;
+        default:
+            h = ram_lak(n);
+            break;
+        }
+        kernel[n + height_sin-1] = (float) h;
+    }
+}
+
+static void backproject_row_scalar(float* row, const float* projection, int length, float u0, float du, int count) {
+    /* padded coordinates are clamped to [0, length+1], where both ends are zero */
+    const float u_max = (float) (length + 1);
+    for (int i = 0; i < count; i++) {
+        float u = u0 + i*du;
+        if ( u < 0.0f ) u = 0.0f;
+        if ( u > u_max ) u = u_max;
+        int k = (int) u;
+        if ( k > length ) k = length;
+        float frac = u - k;
+        row[i] += projection[k] + (projection[k+1] - projection[k])*frac;
+    }
+}
+
+#if FBP_X86
+
+__attribute__((target("avx2,fma")))
+static void backproject_row_avx2(float* row, const float* projection, int length, float u0, float du, int count) {
+    const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 vdu = _mm256_set1_ps(du);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 u_max = _mm256_set1_ps((float) (length + 1));
+    const __m256i k_max = _mm256_set1_epi32(length);
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256 u = _mm256_fmadd_ps(lane, vdu, _mm256_set1_ps(u0 + i*du));
+        u = _mm256_min_ps(_mm256_max_ps(u, zero), u_max);
+        __m256i k = _mm256_min_epi32(_mm256_cvttps_epi32(u), k_max);
+        __m256 frac = _mm256_sub_ps(u, _mm256_cvtepi32_ps(k));
+        __m256 left = _mm256_i32gather_ps(projection, k, 4);
+        __m256 right = _mm256_i32gather_ps(projection + 1, k, 4);
+        __m256 val = _mm256_fmadd_ps(_mm256_sub_ps(right, left), frac, left);
+        _mm256_storeu_ps(row + i, _mm256_add_ps(_mm256_loadu_ps(row + i), val));
+    }
+    backproject_row_scalar(row + i, projection, length, u0 + i*du, du, count - i);
+}
+
+__attribute__((target("avx512f")))
+static void backproject_row_avx512(float* row, const float* projection, int length, float u0, float du, int count) {
+    const __m512 lane = _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512 vdu = _mm512_set1_ps(du);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 u_max = _mm512_set1_ps((float) (length + 1));
+    const __m512i k_max = _mm512_set1_epi32(length);
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m512 u = _mm512_fmadd_ps(lane, vdu, _mm512_set1_ps(u0 + i*du));
+        u = _mm512_min_ps(_mm512_max_ps(u, zero), u_max);
+        __m512i k = _mm512_min_epi32(_mm512_cvttps_epi32(u), k_max);
+        __m512 frac = _mm512_sub_ps(u, _mm512_cvtepi32_ps(k));
+        __m512 left = _mm512_i32gather_ps(k, projection, 4);
+        __m512 right = _mm512_i32gather_ps(k, projection + 1, 4);
+        __m512 val = _mm512_fmadd_ps(_mm512_sub_ps(right, left), frac, left);
+        _mm512_storeu_ps(row + i, _mm512_add_ps(_mm512_loadu_ps(row + i), val));
+    }
+    backproject_row_scalar(row + i, projection, length, u0 + i*du, du, count - i);
+}
+
+#endif
+
+static backproject_row_fn select_backprojector(void) {
+    switch ( simd_level() ) {
+#if FBP_X86
+    case SIMD_AVX512:
+        return backproject_row_avx512;
+    case SIMD_AVX2:
+        return backproject_row_avx2;
+#endif
+    default:
+        return backproject_row_scalar;
+    }
+}
+
+/* NULL if out of memory, nothing is cached then */
+static struct filter_spectrum* filter_spectrum(int length, enum FILTER filter) {
+    struct filter_spectrum* spectrum;
+
+    pthread_mutex_lock(&spectrum_lock);
+    for (spectrum = spectrum_cache; spectrum; spectrum = spectrum->next) {
+        if ( spectrum->length == length && spectrum->filter == filter ) break;
+    }
+
+    if ( !spectrum ) {
+        /* room for the linear convolution of length samples with 2*length-1 taps */
+        int n = fft_length(2*length);
+        float* kernel = malloc((2*length - 1)*sizeof(float));
+        float* data = calloc(2*n, sizeof(float));
+
+        spectrum = calloc(1, sizeof(*spectrum));
+        if ( !kernel || !data || !spectrum || !(spectrum->plan = fft_plan_create(n)) || !(spectrum->response = malloc(n*sizeof(float))) ) {
+            if ( spectrum ) fft_plan_destroy(spectrum->plan);
+            free(spectrum);
+            free(data);
+            free(kernel);
+            pthread_mutex_unlock(&spectrum_lock);
+            return NULL;
+        }
+        spectrum->length = length;
+        spectrum->filter = filter;
+
+        /* kernel wrapped around index 0, tap k at k and -k at n-k */
+        filter_kernel(kernel, length, filter);
+        for (int k = 0; k < length; k++) {
+            data[2*k] = kernel[length-1 + k];
+            if ( k > 0 ) data[2*(n-k)] = kernel[length-1 - k];
+        }
+        fft_forward(spectrum->plan, data);
+        for (int k = 0; k < n; k++) {
+            spectrum->response[k] = data[2*k];
+        }
+
+        spectrum->next = spectrum_cache;
+        spectrum_cache = spectrum;
+        free(data);
+        free(kernel);
+    }
+    pthread_mutex_unlock(&spectrum_lock);
+    return spectrum;
+}
+
+void release_filter_spectra(void) {
+    pthread_mutex_lock(&spectrum_lock);
+    while ( spectrum_cache ) {
+        struct filter_spectrum* next = spectrum_cache->next;
+        fft_plan_destroy(spectrum_cache->plan);
+        free(spectrum_cache->response);
+        free(spectrum_cache);
+        spectrum_cache = next;
+    }
+    pthread_mutex_unlock(&spectrum_lock);
+}
+
+/* filter a batch of projections in place, two at a time */
+static void filter_task(void* ctx, int item, int thread) {
+    struct fbp_job* job = ctx;
+    struct fft_plan* plan = job->spectrum->plan;
+    const float* response = job->spectrum->response;
+    int length = job->height_sin;
+    int total = job->channels*job->angles;
+    int first = item*FILTER_BATCH;
+    int last = first + FILTER_BATCH < total ? first + FILTER_BATCH : total;
+    float* data = job->scratch[thread];
+
+    for (int p = first; p < last; p += 2) {
+        /* projections are stored channel by channel, angle by angle */
+        float* re = job->projections + (long) p*job->stride + 1;
+        float* im = p+1 < last ? re + job->stride : NULL;
+
+        for (int k = 0; k < length; k++) {
+            data[2*k] = re[k];
+            data[2*k+1] = im ? im[k] : 0.0f;
+        }
+        for (int k = 2*length; k < 2*plan->n; k++) {
+            data[k] = 0.0f;
+        }
+
+        fft_forward(plan, data);
+        for (int k = 0; k < plan->n; k++) {
+            data[2*k] *= response[k] * job->scale;
+            data[2*k+1] *= response[k] * job->scale;
+        }
+        fft_inverse(plan, data);
+
+        for (int k = 0; k < length; k++) {
+            re[k] = data[2*k];
+            if ( im ) im[k] = data[2*k+1];
+        }
+    }
+}
+
+/* back-project all angles into one image row */
+static void backproject_task(void* ctx, int item, int thread) {
+    struct fbp_job* job = ctx;
+    int width = job->width;
+    float* row = job->scratch[thread];
+    double y = item + job->pixel - 0.5*job->height;
+    double x0 = job->pixel - 0.5*width;
+
+    for (int c = 0; c < job->channels; c++) {
+        memset(row, 0, width*sizeof(float));
+
+        for (int a = 0; a < job->angles; a++) {
+            const float* projection = job->projections + ((long) c*job->angles + a)*job->stride;
+            /* detector position of the first pixel */
+            double u0 = -x0*job->sin_a[a] + y*job->cos_a[a] + job->center[a];
+            job->backproject_row(row, projection, job->height_sin, (float) u0, (float) -job->sin_a[a], width);
+        }
+
+        float* out = job->image + (long) item*width*job->channels + c;
+        for (int i = 0; i < width; i++) {
+            out[i*job->channels] = row[i];
+        }
+    }
+}
+
+int reconstruct_fbp(float* image, int width, int height, float* sinogram, int angles, int height_sin, int channels, double angle_start, double angle_delta, enum FILTER filter, enum PROJECTOR projector, struct thread_pool* pool) {
+    struct fbp_job job;
+    int threads = pool_size(pool);
+    int scratch_len;
+    int status = 0;
+
+    memset(&job, 0, sizeof(job));
+    job.image = image;
+    job.width = width;
+    job.height = height;
+    job.channels = channels;
+    job.angles = angles;
+    job.height_sin = height_sin;
+    job.stride = height_sin + 2;
+    job.spectrum = filter_spectrum(height_sin, filter);
+    if ( !job.spectrum ) return -1;
+    job.backproject_row = select_backprojector();
+
+    /* Riemann sum over half a turn, a full turn sees every line twice (other arcs are not weighted) */
+    job.scale = (float) (M_PI / angles);
+
+    job.projections = calloc((long) channels*angles*job.stride, sizeof(float));
+    job.cos_a = malloc(angles*sizeof(double));
+    job.sin_a = malloc(angles*sizeof(double));
+    job.center = malloc(angles*sizeof(double));
+    job.pixel = projector == PROJECT_ROTATE ? 0.0 : 0.5;
+    scratch_len = 2*job.spectrum->plan->n > width ? 2*job.spectrum->plan->n : width;
+    job.scratch = calloc(threads, sizeof(float*));
+    for (int t = 0; job.scratch && t < threads; t++) {
+        if ( !(job.scratch[t] = malloc(scratch_len*sizeof(float))) ) status = -1;
+    }
+    if ( !job.projections || !job.cos_a || !job.sin_a || !job.center || !job.scratch || status != 0 ) {
+        status = -1;
+        goto done;
+    }
+
+    /* split the contiguous projection of every angle into padded per-channel rows */
+    for (int a = 0; a < angles; a++) {
+        const float* source = sinogram + (long) a*height_sin*channels;
+        for (int c = 0; c < channels; c++) {
+            float* projection = job.projections + ((long) c*angles + a)*job.stride + 1;
+            for (int d = 0; d < height_sin; d++) {
+                projection[d] = source[d*channels + c];
+            }
+        }
+    }
+    for (int a = 0; a < angles; a++) {
+        double angle_rad = (angle_start + a*angle_delta) * M_PI / 180.0;
+        job.cos_a[a] = cos(angle_rad);
+        job.sin_a[a] = sin(angle_rad);
+        if ( projector == PROJECT_ROTATE ) {
+            /* the rotated image is centered on the detector with integer offsets */
+            int width_rot, height_rot;
+            size_of_rotated_image(&width_rot, &height_rot, height, width, angle_rad);
+            job.center[a] = height_rot/2 + (height_sin - height_rot)/2 + 1.0;
+        }
+        else {
+            job.center[a] = 0.5*height_sin - 0.5 + 1.0;
+        }
+    }
+    pool_run(pool, (channels*angles + FILTER_BATCH-1) / FILTER_BATCH, filter_task, &job);
+    pool_run(pool, height, backproject_task, &job);
+
+done:
+    for (int t = 0; job.scratch && t < threads; t++) {
+        free(job.scratch[t]);
+    }
+    free(job.scratch);
+    free(job.center);
+    free(job.sin_a);
+    free(job.cos_a);
+    free(job.projections);
+    return status;
+}
@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <math.h>
+#include "fft.h"
+
+int fft_length(int n) {
+    int len = 1;
+    while ( len < n ) len <<= 1;
+    return len;
+}
+
+struct fft_plan* fft_plan_create(int n) {
+    struct fft_plan* plan;
+    int bits = 0;
+
+    if ( n < 1 || (n & (n-1)) != 0 ) return NULL;
+
+    plan = malloc(sizeof(*plan));
+    if ( !plan ) return NULL;
+    plan->n = n;
+    plan->twiddles = malloc((n/2 > 0 ? n/2 : 1)*2*sizeof(float));
+    plan->bitrev = malloc(n*sizeof(int));
+    if ( !plan->twiddles || !plan->bitrev ) {
+        fft_plan_destroy(plan);
+        return NULL;
+    }
+
+    for (int k = 0; k < n/2; k++) {
+        double phase = -2.0*M_PI*k/n;
+        plan->twiddles[2*k] = (float) cos(phase);
+        plan->twiddles[2*k+1] = (float) sin(phase);
+    }
+
+    while ( (1 << bits) < n ) bits++;
+    for (int k = 0; k < n; k++) {
+        int r = 0;
+        for (int b = 0; b < bits; b++) {
+            r |= ((k >> b) & 1) << (bits-1-b);
+        }
+        plan->bitrev[k] = r;
+    }
+    return plan;
+}
+
+void fft_plan_destroy(struct fft_plan* plan) {
+    if ( !plan ) return;
+    free(plan->bitrev);
+    free(plan->twiddles);
+    free(plan);
+}
+
+/* iterative decimation in time, sign = -1 forward, +1 inverse */
+static void transform(struct fft_plan* plan, float* data, float sign) {
+    int n = plan->n;
+
+    for (int k = 0; k < n; k++) {
+        int r = plan->bitrev[k];
+        if ( r > k ) {
+            float re = data[2*k], im = data[2*k+1];
+            data[2*k] = data[2*r];
+            data[2*k+1] = data[2*r+1];
+            data[2*r] = re;
+            data[2*r+1] = im;
+        }
+    }
+
+    for (int len = 2; len <= n; len <<= 1) {
+        int half = len/2;
+        int step = n/len;
+        for (int i = 0; i < n; i += len) {
+            float* lo = data + 2*i;
+            float* hi = data + 2*(i + half);
+            for (int j = 0; j < half; j++) {
+                float w_re = plan->twiddles[2*j*step];
+                float w_im = sign * -plan->twiddles[2*j*step+1];
+                float v_re = hi[2*j]*w_re - hi[2*j+1]*w_im;
+                float v_im = hi[2*j]*w_im + hi[2*j+1]*w_re;
+                hi[2*j] = lo[2*j] - v_re;
+                hi[2*j+1] = lo[2*j+1] - v_im;
+                lo[2*j] += v_re;
+                lo[2*j+1] += v_im;
+            }
+        }
+    }
+}
+
+void fft_forward(struct fft_plan* plan, float* data) {
+    transform(plan, data, -1.0f);
+}
+
+void fft_inverse(struct fft_plan* plan, float* data) {
+    float scale = 1.0f / plan->n;
+    transform(plan, data, 1.0f);
+    for (int k = 0; k < 2*plan->n; k++) {
+        data[k] *= scale;
+    }
+}
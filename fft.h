@@ -0,0 +1,32 @@
+#ifndef FFT_H
+#define FFT_H
+
+/*
+ * Small self-contained radix-2 FFT.
+ *
+ * A plan holds the twiddle factors and the bit reversal permutation for one transform
+ * length, so repeated transforms of the same length only do the butterflies. Data is
+ * an array of n complex values stored as interleaved (re, im) floats and is transformed
+ * in place.
+ */
+
+struct fft_plan {
+    int n;              /* transform length, power of two */
+    float* twiddles;    /* exp(-2 pi i k/n) for k < n/2, interleaved (re, im) */
+    int* bitrev;        /* bit reversed index of every k < n */
+};
+
+/* smallest power of two >= n */
+int fft_length(int n);
+
+/* NULL if n is not a power of two or out of memory */
+struct fft_plan* fft_plan_create(int n);
+
+void fft_plan_destroy(struct fft_plan* plan);
+
+void fft_forward(struct fft_plan* plan, float* data);
+
+/* inverse transform including the 1/n normalization */
+void fft_inverse(struct fft_plan* plan, float* data);
+
+#endif
@@ -0,0 +1,307 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sinogram.h"
+#include "sysmatrix.h"
+#include "threads.h"
+
+/*
+ * Iterative reconstruction.
+ *
+ * SIRT and SART solve A x = b for the system matrix A of the ray-driven projector with
+ * the update
+ *
+ *   x_j += relaxation * sum_i a_ij (b_i - A_i x) / R_i / C_j
+ *
+ * where R_i is the sum of row i and C_j the sum of column j over the rows of the current
+ * subset of angles: all angles at once for SIRT, one angle after the other for SART, or
+ * ordered subsets in between. Subsets interleave, so each one covers the whole angular
+ * range, and consecutive subsets should be as different as possible: bit-reversal and
+ * golden-ratio orderings jump across the range instead of stepping through it. The
+ * subsets, their order and the inverted row sums are set up once.
+ *
+ * A subset costs one forward pass (the residual, gathered row by row like the matrix
+ * product) and one transpose pass, system_matrix_backproject() of the residual into the
+ * correction image. The column sums of a subset are the back-projection of a sinogram of
+ * ones over its angles, computed once for every subset and inverted. The table grows with
+ * subsets x pixels (3 GB of floats at 1024x1024 with 720 SART subsets), so beyond a fixed
+ * size only the upper 16 bits of every float are kept, rounded, which is 8 significant
+ * bits. The column sums only scale the step of each pixel, so this changes how fast the
+ * iteration converges, not what it converges to. A subset unpacks its sums into one float
+ * image when it is visited. All buffers are allocated when the solver is created.
+ */
+
+/* 1/golden ratio, the golden-ratio ordering steps this far around the range of subsets */
+#define GOLDEN_STEP 0.6180339887498949
+
+/* inverted column sums of all subsets are kept as floats up to this size, beyond it in 16 bits */
+#define COL_SUM_CACHE_BYTES ((size_t) 64 << 20)
+
+struct iterative_solver {
+    struct system_matrix* matrix;
+    struct thread_pool* pool;
+    int channels;
+    int subsets;
+    int* subset_start;              /* subset s holds angles subset_angles[subset_start[s] .. subset_start[s+1]-1] */
+    int* subset_angles;
+    float* inv_row_sums;            /* rows, 0 for rays that miss the image */
+    float* ones;                    /* rows, the sinogram that back-projects into the column sums */
+    float* inv_col_sums;            /* subsets x pixels, or 1 x pixels unpacked from packed_col_sums; 0 for pixels no ray of the subset crosses */
+    uint16_t* packed_col_sums;      /* subsets x pixels, the upper halves of the floats, NULL while the floats fit */
+    float* residual;                /* rows x channels */
+    float* correction;              /* pixels x channels, all zero between subsets */
+};
+
+/* arguments of one pool_run() */
+struct iterative_pass {
+    struct iterative_solver* solver;
+    float* image;
+    const float* sinogram;
+    const int* angles;              /* angles of the current subset */
+    float* inv_col_sums;            /* of the current subset */
+    uint16_t* packed_col_sums;      /* of the subset being packed or unpacked */
+    float relaxation;
+};
+
+static void row_sum_task(void* ctx, int item, int thread) {
+    struct iterative_pass* pass = ctx;
+    struct system_matrix* matrix = pass->solver->matrix;
+    long first_row = (long) item*matrix->height_sin;
+    (void) thread;
+
+    for (long row = first_row; row < first_row + matrix->height_sin; row++) {
+        float sum = 0.0f;
+        for (int64_t k = matrix->row_ptr[row]; k < matrix->row_ptr[row + 1]; k++) {
+            sum += matrix->weights[k];
+        }
+        pass->solver->inv_row_sums[row] = sum > 0.0f ? 1.0f / sum : 0.0f;
+    }
+}
+
+static void invert_task(void* ctx, int item, int thread) {
+    struct iterative_pass* pass = ctx;
+    struct system_matrix* matrix = pass->solver->matrix;
+    float* col_sums = pass->inv_col_sums + (size_t) item*matrix->width;
+    (void) thread;
+
+    for (int col = 0; col < matrix->width; col++) {
+        col_sums[col] = col_sums[col] > 0.0f ? 1.0f / col_sums[col] : 0.0f;
+    }
+}
+
+/* round an image row of non-negative floats to their upper 16 bits */
+static void pack_task(void* ctx, int item, int thread) {
+    struct iterative_pass* pass = ctx;
+    size_t first = (size_t) item*pass->solver->matrix->width;
+    (void) thread;
+
+    for (size_t j = first; j < first + pass->solver->matrix->width; j++) {
+        uint32_t bits;
+        memcpy(&bits, pass->inv_col_sums + j, sizeof(bits));
+        pass->packed_col_sums[j] = (uint16_t) ((bits + 0x7FFF + ((bits >> 16) & 1)) >> 16);
+    }
+}
+
+static void unpack_task(void* ctx, int item, int thread) {
+    struct iterative_pass* pass = ctx;
+    size_t first = (size_t) item*pass->solver->matrix->width;
+    (void) thread;
+
+    for (size_t j = first; j < first + pass->solver->matrix->width; j++) {
+        uint32_t bits = (uint32_t) pass->packed_col_sums[j] << 16;
+        memcpy(pass->inv_col_sums + j, &bits, sizeof(bits));
+    }
+}
+
+/* normalized residual (b_i - A_i x) / R_i of every bin of one angle of the subset */
+static void residual_task(void* ctx, int item, int thread) {
+    struct iterative_pass* pass = ctx;
+    struct iterative_solver* solver = pass->solver;
+    struct system_matrix* matrix = solver->matrix;
+    int channels = solver->channels;
+    long first_row = (long) pass->angles[item]*matrix->height_sin;
+    float sum[NUM_CHANNELS];
+    (void) thread;
+
+    for (long row = first_row; row < first_row + matrix->height_sin; row++) {
+        const float* b = pass->sinogram + row*channels;
+        float* r = solver->residual + row*channels;
+
+        for ( int c = 0; c < channels; c++ ) sum[c] = 0.0f;
+        for (int64_t k = matrix->row_ptr[row]; k < matrix->row_ptr[row + 1]; k++) {
+            float weight = matrix->weights[k];
+            const float* pixel = pass->image + (size_t) matrix->cols[k]*channels;
+            for ( int c = 0; c < channels; c++ ) {
+                sum[c] += weight * pixel[c];
+            }
+        }
+        for ( int c = 0; c < channels; c++ ) {
+            r[c] = (b[c] - sum[c]) * solver->inv_row_sums[row];
+        }
+    }
+}
+
+/* apply the correction of one image row and clear it for the next subset, pixel values stay non-negative */
+static void update_task(void* ctx, int item, int thread) {
+    struct iterative_pass* pass = ctx;
+    struct iterative_solver* solver = pass->solver;
+    struct system_matrix* matrix = solver->matrix;
+    int channels = solver->channels;
+    const float* inv_col_sums = pass->inv_col_sums + (size_t) item*matrix->width;
+    float* pixel = pass->image + (size_t) item*matrix->width*channels;
+    float* correction = solver->correction + (size_t) item*matrix->width*channels;
+    (void) thread;
+
+    for (int col = 0; col < matrix->width; col++) {
+        float scale = pass->relaxation * inv_col_sums[col];
+        for ( int c = 0; c < channels; c++ ) {
+            float value = pixel[c] + scale*correction[c];
+            pixel[c] = value > 0.0f ? value : 0.0f;
+            correction[c] = 0.0f;
+        }
+        pixel += channels;
+        correction += channels;
+    }
+}
+
+/* visiting order of subsets, a permutation of 0..subsets-1 */
+static void subset_order(int* order, int subsets, enum SUBSET_ORDER kind) {
+    char* taken = kind == ORDER_GOLDEN_RATIO ? calloc(subsets, 1) : NULL;
+    int bits = 0, n = 0;
+
+    if ( kind == ORDER_BIT_REVERSAL ) {
+        /* bit-reversed counting over the next power of two, skipping indices past the end */
+        while ( (1 << bits) < subsets ) bits++;
+        for (int i = 0; i < 1 << bits; i++) {
+            int reversed = 0;
+            for (int b = 0; b < bits; b++) {
+                if ( i & (1 << b) ) reversed |= 1 << (bits - 1 - b);
+            }
+            if ( reversed < subsets ) order[n++] = reversed;
+        }
+    }
+    else if ( taken ) {
+        /* the k-th subset at fraction k*GOLDEN_STEP of the range, or the next one not taken yet */
+        for (int k = 0; k < subsets; k++) {
+            int s = (int) ((k*GOLDEN_STEP - floor(k*GOLDEN_STEP))*subsets);
+            while ( taken[s] ) s = (s + 1) % subsets;
+            taken[s] = 1;
+            order[k] = s;
+        }
+        free(taken);
+    }
+    else {
+        for (int k = 0; k < subsets; k++) order[k] = k;
+    }
+}
+
+/* inverted column sums of one subset into inv_col_sums, pixels long */
+static void subset_col_sums(struct iterative_solver* solver, struct iterative_pass* pass, int subset, float* inv_col_sums) {
+    struct system_matrix* matrix = solver->matrix;
+    int first = solver->subset_start[subset];
+
+    memset(inv_col_sums, 0, (size_t) matrix->width*matrix->height*sizeof(float));
+    system_matrix_backproject(matrix, inv_col_sums, solver->ones, 1, solver->subset_angles + first, solver->subset_start[subset + 1] - first, solver->pool);
+    pass->inv_col_sums = inv_col_sums;
+    pool_run(solver->pool, matrix->height, invert_task, pass);
+}
+
+struct iterative_solver* iterative_create(struct system_matrix* matrix, int subsets, enum SUBSET_ORDER order, int channels, struct thread_pool* pool) {
+    struct iterative_solver* solver = calloc(1, sizeof(*solver));
+    size_t pixels = (size_t) matrix->width*matrix->height;
+    long rows = (long) matrix->angles*matrix->height_sin;
+    struct iterative_pass pass;
+    int packed;
+
+    if ( !solver ) return NULL;
+    solver->matrix = matrix;
+    solver->pool = pool;
+    solver->channels = channels;
+    solver->subsets = subsets <= 0 || subsets > matrix->angles ? matrix->angles : subsets;
+    packed = solver->subsets*pixels*sizeof(float) > COL_SUM_CACHE_BYTES;
+
+    solver->subset_start = malloc((solver->subsets + 1)*sizeof(int));
+    solver->subset_angles = malloc(matrix->angles*sizeof(int));
+    solver->inv_row_sums = malloc(rows*sizeof(float));
+    solver->ones = malloc(rows*sizeof(float));
+    solver->inv_col_sums = malloc((packed ? 1 : solver->subsets)*pixels*sizeof(float));
+    if ( packed ) solver->packed_col_sums = malloc(solver->subsets*pixels*sizeof(uint16_t));
+    solver->residual = malloc(rows*channels*sizeof(float));
+    solver->correction = calloc(pixels*channels, sizeof(float));
+    if ( !solver->subset_start || !solver->subset_angles || !solver->inv_row_sums || !solver->ones || !solver->inv_col_sums || (packed && !solver->packed_col_sums) || !solver->residual || !solver->correction ) {
+        iterative_destroy(solver);
+        return NULL;
+    }
+    for (long row = 0; row < rows; row++) {
+        solver->ones[row] = 1.0f;
+    }
+
+    /* the angles of every subset in visiting order, reusing subset_start for the order */
+    subset_order(solver->subset_start, solver->subsets, order);
+    for (int i = 0, n = 0; i < solver->subsets; i++) {
+        int s = solver->subset_start[i];
+        solver->subset_start[i] = n;
+        for (int a = s; a < matrix->angles; a += solver->subsets) {
+            solver->subset_angles[n++] = a;
+        }
+    }
+    solver->subset_start[solver->subsets] = matrix->angles;
+
+    memset(&pass, 0, sizeof(pass));
+    pass.solver = solver;
+    pool_run(pool, matrix->angles, row_sum_task, &pass);
+    for (int subset = 0; subset < solver->subsets; subset++) {
+        subset_col_sums(solver, &pass, subset, solver->inv_col_sums + (packed ? 0 : subset*pixels));
+        if ( packed ) {
+            pass.packed_col_sums = solver->packed_col_sums + subset*pixels;
+            pool_run(pool, matrix->height, pack_task, &pass);
+        }
+    }
+    return solver;
+}
+
+void iterative_run(struct iterative_solver* solver, float* image, const float* sinogram, int iterations, double relaxation) {
+    size_t pixels = (size_t) solver->matrix->width*solver->matrix->height;
+    struct iterative_pass pass;
+
+    memset(&pass, 0, sizeof(pass));
+    pass.solver = solver;
+    pass.image = image;
+    pass.sinogram = sinogram;
+    pass.relaxation = (float) relaxation;
+
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        for (int subset = 0; subset < solver->subsets; subset++) {
+            int first = solver->subset_start[subset];
+            int count = solver->subset_start[subset + 1] - first;
+
+            if ( solver->packed_col_sums ) {
+                pass.inv_col_sums = solver->inv_col_sums;
+                pass.packed_col_sums = solver->packed_col_sums + (size_t) subset*pixels;
+                pool_run(solver->pool, solver->matrix->height, unpack_task, &pass);
+            }
+            else {
+                pass.inv_col_sums = solver->inv_col_sums + (size_t) subset*pixels;
+            }
+
+            pass.angles = solver->subset_angles + first;
+            pool_run(solver->pool, count, residual_task, &pass);
+            system_matrix_backproject(solver->matrix, solver->correction, solver->residual, solver->channels, pass.angles, count, solver->pool);
+            pool_run(solver->pool, solver->matrix->height, update_task, &pass);
+        }
+    }
+}
+
+void iterative_destroy(struct iterative_solver* solver) {
+    if ( !solver ) return;
+    free(solver->subset_start);
+    free(solver->subset_angles);
+    free(solver->inv_row_sums);
+    free(solver->ones);
+    free(solver->inv_col_sums);
+    free(solver->packed_col_sums);
+    free(solver->residual);
+    free(solver->correction);
+    free(solver);
+}
@@ -1,282 +1,807 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
-#include <time.h>
-#define STB_IMAGE_IMPLEMENTATION
 #include "stb/stb_image.h"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb/stb_image_write.h"
 
-enum CHANNELS { RED, GREEN, BLUE, ALPHA, NUM_CHANNELS };
-
-void draw_channel(unsigned char* input_image, int width, int height, int channels, enum CHANNELS offset);
-
-void size_of_rotated_image(int* width_rot, int* height_rot, int height, int width, double angle_rad);
-
-void rotate_image(unsigned char* rotated_image, unsigned char* input_image, double angle_rad, int width, int height, int width_rot, int height_rot, int channels, enum CHANNELS offset);
-
-void rotate_position(double* x, double* y, int pixel_num, double angle_rad, int width_rot, int height_rot, int width, int height);
-
-void fill_sinogram(unsigned char* sinogram, int height_sin, int angles, unsigned char* rotated_image, int width_rot, int height_rot, int channels, int angle_deg, int angle_delta);
+#include "sinogram.h"
+#include "threads.h"
+#include "trace.h"
+#include "sysmatrix.h"
+#include "volume.h"
+#include "phantom.h"
+
+/* rotated images waiting for the background writer */
+#define DUMP_QUEUE_LENGTH 8
+
+/* command line settings, defaults reproduce the original hardcoded run */
+struct options {
+    char* input_filename;
+    char* phantom_name;             /* project this analytic phantom instead of the input image */
+    int phantom_size;
+    char* output_filename;
+    enum SINOGRAM_FORMAT format;
+    double angle_start, angle_end, angle_delta;
+    int detectors;                  /* 0 = image diagonal */
+    int detector_rows;              /* cone-beam detector rows, 0 = fit the volume */
+    enum PROJECTOR projector;
+    enum INTERPOLATION interp;
+    enum ROTATION rotation;         /* rotate projector: gather, or three shears */
+    struct fan_geometry fan;        /* distances of 0 are derived from the image size */
+    int num_threads;                /* 1 runs the angle loop serially */
+    enum SIMD_LEVEL simd;           /* widest vector kernels dispatched, if the CPU has them */
+    int symmetry;                   /* mirror ray projections 180 degrees apart instead of projecting each */
+    int save_rotated;               /* dump rotated<angle>.png for every angle */
+    int dump_compression;           /* PNG compression level of the dumps */
+    char* reconstruction_filename;  /* filtered back-projection output, NULL = none */
+    char* sinogram_filename;        /* reconstruct this sinogram instead of projecting */
+    char* matrix_filename;          /* project with this system matrix, NULL = projector loop */
+    char* batch_path;               /* directory or list of slices to project, NULL = single image */
+    char* output_dir;               /* where batch sinograms are written */
+    char* volume_filename;          /* raw or NRRD volume to project slab by slab, NULL = 2D image */
+    int volume_width, volume_height, volume_depth;  /* size of a raw volume */
+    enum VOXEL_TYPE volume_type;
+    int volume_big_endian;
+    int slab;                       /* slices of the volume held in memory */
+    int width, height;              /* reconstruction size when reading a sinogram */
+    enum FILTER filter;
+    int iterative;                  /* reconstruct with SIRT, (OS-)SART instead of FBP */
+    int subsets;                    /* angle subsets, 1 = SIRT, 0 = one per angle (SART) */
+    enum SUBSET_ORDER subset_order;
+    int iterations;
+    double relaxation;
+    char* trace_filename;           /* Chrome trace JSON of the instrumented scopes, NULL = none */
+};
+
+static void usage(const char* program) {
+    printf("Usage: %s [options]\n"
+           "  -i, --input FILE           input image (default square.png)\n"
+           "  -o, --output FILE          sinogram output (default sinogram.png)\n"
+           "      --phantom NAME         project the analytic phantom shepp-logan, ellipses or rectangles instead\n"
+           "                             of an input image and report the error against its exact sinogram\n"
+           "      --phantom-size N       size of the rasterized phantom (default 512)\n"
+           "  -b, --batch PATH           project every image of directory PATH, or listed one per line in file\n"
+           "                             PATH, all of the size of the first one, rotated images are not dumped\n"
+           "      --output-dir DIR       where batch sinograms go, named after their slices (default .)\n"
+           "      --volume FILE          project a 3D volume (.nrrd/.nhdr or raw) slab by slab into a stack\n"
+           "                             of projections, angles x depth x detectors, written as npy32 or raw32\n"
+           "      --volume-size WxHxD    size of a raw volume\n"
+           "      --volume-type TYPE     voxels of a raw volume, u8, u16, i16 or f32 (default u16)\n"
+           "      --big-endian           raw volume voxels are big endian (default little)\n"
+           "      --slab N               volume slices held in memory at a time (default 16)\n"
+           "      --format FMT           png, npy16, npy32 or raw32 (default from output extension)\n"
+           "      --angle-start DEG      first angle (default 0)\n"
+           "      --angle-end DEG        angles stop before this one (default 360)\n"
+           "      --angle-step DEG       angle increment, may be fractional (default 10)\n"
+           "      --detectors N          sinogram height, cone-beam detector columns (default image diagonal)\n"
+           "      --det-rows N           cone-beam detector rows (default fits the volume)\n"
+           "      --projector NAME       rotate, ray, fan or cone (default rotate), cone needs --volume\n"
+           "      --sid D                fan source to isocenter distance in pixels (default image diagonal)\n"
+           "      --sdd D                fan source to detector distance in pixels (default 2*sid)\n"
+           "      --detector TYPE        fan detector, flat or curved (default flat), cone-beam is flat\n"
+           "      --det-spacing S        fan detector bin pitch in pixels (default sdd/sid, one pixel at the center)\n"
+           "      --interp NAME          nearest or bilinear (default nearest)\n"
+           "      --rotation NAME        rotate projector engine, gather (sampled with --interp), or shear or\n"
+           "                             shear-sinc for three 1D shears, linear or windowed sinc (default gather)\n"
+           "      --matrix FILE          project with the sparse system matrix in FILE (ray projector weights),\n"
+           "                             built and saved there first if missing or of another geometry\n"
+           "      --no-symmetry          project every angle, instead of mirroring the ray projection 180 degrees\n"
+           "                             apart (the result is the same, the rotate projector always projects each)\n"
+           "  -j, --threads N            worker threads (default all CPUs)\n"
+           "      --simd NAME            widest vector kernels, scalar, avx2 or avx512 (default the best the\n"
+           "                             CPU has), the samplers give the same result at every level\n"
+           "      --dump-rotated         write rotated<angle>.png for every angle, in the background\n"
+           "      --dump-compression N   PNG compression level of the dumps (default 8, stb uses at least 5)\n"
+           "      --no-rotated           no rotated image dumps (default)\n"
+           "  -r, --reconstruct FILE     filtered back-projection of the sinogram into FILE\n"
+           "      --filter NAME          ram-lak, shepp-logan or hann (default shepp-logan)\n"
+           "      --iterative NAME       reconstruct with sirt, sart or os-sart on the ray projector's system\n"
+           "                             matrix (--matrix FILE to keep it) instead of filtered back-projection,\n"
+           "                             needs --projector ray or --matrix\n"
+           "      --subsets N            ordered subsets of interleaved angles for os-sart (default 10),\n"
+           "                             alone it selects os-sart\n"
+           "      --subset-order NAME    sequential, bit-reversal or golden-ratio (default bit-reversal)\n"
+           "      --iterations N         passes over all angles (default 20)\n"
+           "      --relaxation L         step size of the updates, 0 < L < 2 (default 1)\n"
+           "      --sinogram FILE        reconstruct FILE (PNG or NPY) instead of projecting an image\n"
+           "                             (in the detector geometry of --projector)\n"
+           "      --size WxH             reconstruction size for --sinogram (default fits the detector)\n"
+           "      --trace FILE           write a Chrome trace JSON of all stages and angles into FILE and a\n"
+           "                             summary to stderr, needs a build with -DSINOGRAM_TRACE (make trace)\n"
+           "  -h, --help                 show this help\n", program);
+}
 
-unsigned char nearest_neighbour(unsigned char* input_image, double x, double y, int width, int height, int channels, enum CHANNELS offset);
+static enum SINOGRAM_FORMAT format_from_filename(const char* filename) {
+    const char* ext = strrchr(filename, '.');
+    if ( ext && strcmp(ext, ".npy") == 0 ) return FORMAT_NPY32;
+    if ( ext && (strcmp(ext, ".raw") == 0 || strcmp(ext, ".f32") == 0) ) return FORMAT_RAW32;
+    return FORMAT_PNG8;
+}
 
-unsigned char bilinear_interp(unsigned char* input_image, double x, double y, int width, int height, int channels, enum CHANNELS offset);
+static int is_option(const char* arg, const char* short_name, const char* long_name) {
+    return (short_name && strcmp(arg, short_name) == 0) || strcmp(arg, long_name) == 0;
+}
 
-int main(void) {
-    clock_t start_time;
-    double cpu_time_used;
-    
-    start_time = clock();
+/* returns 0 to continue, 1 to exit successfully, -1 on error */
+static int parse_options(struct options* opt, int argc, char** argv) {
+    int format_given = 0;
+    const char* method = NULL;          /* --iterative, resolved into opt->subsets after all options */
+    int subsets_given = 0;
+
+    opt->input_filename = "square.png";
+    opt->phantom_name = NULL;
+    opt->phantom_size = 512;
+    opt->output_filename = "sinogram.png";
+    opt->format = FORMAT_PNG8;
+    opt->angle_start = 0.0;
+    opt->angle_end = 360.0;
+    opt->angle_delta = 10.0;
+    opt->detectors = 0;
+    opt->detector_rows = 0;
+    opt->projector = PROJECT_ROTATE;
+    opt->interp = NEAREST;
+    opt->rotation = ROTATION_GATHER;
+    memset(&opt->fan, 0, sizeof(opt->fan));
+    opt->num_threads = cpu_count();
+    opt->simd = SIMD_AVX512;
+    opt->symmetry = 1;
+    opt->save_rotated = 0;
+    opt->dump_compression = 8;
+    opt->reconstruction_filename = NULL;
+    opt->sinogram_filename = NULL;
+    opt->matrix_filename = NULL;
+    opt->batch_path = NULL;
+    opt->output_dir = ".";
+    opt->volume_filename = NULL;
+    opt->volume_width = opt->volume_height = opt->volume_depth = 0;
+    opt->volume_type = VOXEL_U16;
+    opt->volume_big_endian = 0;
+    opt->slab = 16;
+    opt->width = opt->height = 0;
+    opt->filter = FILTER_SHEPP_LOGAN;
+    opt->iterative = 0;
+    opt->subsets = 1;
+    opt->subset_order = ORDER_BIT_REVERSAL;
+    opt->iterations = 20;
+    opt->relaxation = 1.0;
+    opt->trace_filename = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        char* arg = argv[i];
+        char* value = i+1 < argc ? argv[i+1] : NULL;
+
+#define IS(short_name, long_name) is_option(arg, short_name, long_name)
+#define NEED_VALUE() do { if ( !value ) { fprintf(stderr, "%s needs a value\n", arg); return -1; } i++; } while (0)
+
+        if ( IS("-h", "--help") ) {
+            usage(argv[0]);
+            return 1;
+        }
+        else if ( IS("-i", "--input") )         { NEED_VALUE(); opt->input_filename = value; }
+        else if ( IS(NULL, "--phantom") )       { NEED_VALUE(); opt->phantom_name = value; }
+        else if ( IS(NULL, "--phantom-size") )  { NEED_VALUE(); opt->phantom_size = atoi(value); }
+        else if ( IS("-o", "--output") )        { NEED_VALUE(); opt->output_filename = value; }
+        else if ( IS(NULL, "--angle-start") )   { NEED_VALUE(); opt->angle_start = atof(value); }
+        else if ( IS(NULL, "--angle-end") )     { NEED_VALUE(); opt->angle_end = atof(value); }
+        else if ( IS(NULL, "--angle-step") )    { NEED_VALUE(); opt->angle_delta = atof(value); }
+        else if ( IS(NULL, "--detectors") )     { NEED_VALUE(); opt->detectors = atoi(value); }
+        else if ( IS(NULL, "--det-rows") )      { NEED_VALUE(); opt->detector_rows = atoi(value); }
+        else if ( IS("-j", "--threads") )       { NEED_VALUE(); opt->num_threads = atoi(value); }
+        else if ( IS(NULL, "--dump-rotated") )  { opt->save_rotated = 1; }
+        else if ( IS(NULL, "--no-rotated") )    { opt->save_rotated = 0; }
+        else if ( IS(NULL, "--no-symmetry") )   { opt->symmetry = 0; }
+        else if ( IS(NULL, "--dump-compression") ) { NEED_VALUE(); opt->dump_compression = atoi(value); }
+        else if ( IS("-r", "--reconstruct") )   { NEED_VALUE(); opt->reconstruction_filename = value; }
+        else if ( IS(NULL, "--sinogram") )      { NEED_VALUE(); opt->sinogram_filename = value; }
+        else if ( IS(NULL, "--matrix") )        { NEED_VALUE(); opt->matrix_filename = value; }
+        else if ( IS("-b", "--batch") )         { NEED_VALUE(); opt->batch_path = value; }
+        else if ( IS(NULL, "--output-dir") )    { NEED_VALUE(); opt->output_dir = value; }
+        else if ( IS(NULL, "--volume") )        { NEED_VALUE(); opt->volume_filename = value; }
+        else if ( IS(NULL, "--iterations") )    { NEED_VALUE(); opt->iterations = atoi(value); }
+        else if ( IS(NULL, "--relaxation") )    { NEED_VALUE(); opt->relaxation = atof(value); }
+        else if ( IS(NULL, "--iterative") ) {
+            NEED_VALUE();
+            if ( strcmp(value, "sirt") != 0 && strcmp(value, "sart") != 0 && strcmp(value, "os-sart") != 0 ) {
+                fprintf(stderr, "Unknown iterative method %s\n", value);
+                return -1;
+            }
+            method = value;
+            opt->iterative = 1;
+        }
+        else if ( IS(NULL, "--subsets") ) {
+            NEED_VALUE();
+            opt->subsets = atoi(value);
+            if ( opt->subsets < 1 ) { fprintf(stderr, "--subsets needs a positive count\n"); return -1; }
+            subsets_given = 1;
+            opt->iterative = 1;
+        }
+        else if ( IS(NULL, "--subset-order") ) {
+            NEED_VALUE();
+            if ( strcmp(value, "sequential") == 0 ) opt->subset_order = ORDER_SEQUENTIAL;
+            else if ( strcmp(value, "bit-reversal") == 0 ) opt->subset_order = ORDER_BIT_REVERSAL;
+            else if ( strcmp(value, "golden-ratio") == 0 ) opt->subset_order = ORDER_GOLDEN_RATIO;
+            else { fprintf(stderr, "Unknown subset order %s\n", value); return -1; }
+        }
+        else if ( IS(NULL, "--trace") )         { NEED_VALUE(); opt->trace_filename = value; }
+        else if ( IS(NULL, "--sid") )           { NEED_VALUE(); opt->fan.sid = atof(value); }
+        else if ( IS(NULL, "--sdd") )           { NEED_VALUE(); opt->fan.sdd = atof(value); }
+        else if ( IS(NULL, "--det-spacing") )   { NEED_VALUE(); opt->fan.spacing = atof(value); }
+        else if ( IS(NULL, "--detector") ) {
+            NEED_VALUE();
+            if ( strcmp(value, "flat") == 0 ) opt->fan.curved = 0;
+            else if ( strcmp(value, "curved") == 0 ) opt->fan.curved = 1;
+            else { fprintf(stderr, "Unknown detector %s\n", value); return -1; }
+        }
+        else if ( IS(NULL, "--big-endian") )    { opt->volume_big_endian = 1; }
+        else if ( IS(NULL, "--slab") )          { NEED_VALUE(); opt->slab = atoi(value); }
+        else if ( IS(NULL, "--volume-size") ) {
+            NEED_VALUE();
+            if ( sscanf(value, "%dx%dx%d", &opt->volume_width, &opt->volume_height, &opt->volume_depth) != 3 ) {
+                fprintf(stderr, "Bad volume size %s, expected WxHxD\n", value);
+                return -1;
+            }
+        }
+        else if ( IS(NULL, "--volume-type") ) {
+            NEED_VALUE();
+            if ( strcmp(value, "u8") == 0 ) opt->volume_type = VOXEL_U8;
+            else if ( strcmp(value, "u16") == 0 ) opt->volume_type = VOXEL_U16;
+            else if ( strcmp(value, "i16") == 0 ) opt->volume_type = VOXEL_I16;
+            else if ( strcmp(value, "f32") == 0 ) opt->volume_type = VOXEL_F32;
+            else { fprintf(stderr, "Unknown voxel type %s\n", value); return -1; }
+        }
+        else if ( IS(NULL, "--size") ) {
+            NEED_VALUE();
+            if ( sscanf(value, "%dx%d", &opt->width, &opt->height) != 2 ) {
+                fprintf(stderr, "Bad size %s, expected WxH\n", value);
+                return -1;
+            }
+        }
+        else if ( IS(NULL, "--format") ) {
+            NEED_VALUE();
+            format_given = 1;
+            if ( strcmp(value, "png") == 0 ) opt->format = FORMAT_PNG8;
+            else if ( strcmp(value, "npy16") == 0 ) opt->format = FORMAT_NPY16;
+            else if ( strcmp(value, "npy32") == 0 ) opt->format = FORMAT_NPY32;
+            else if ( strcmp(value, "raw32") == 0 ) opt->format = FORMAT_RAW32;
+            else { fprintf(stderr, "Unknown format %s\n", value); return -1; }
+        }
+        else if ( IS(NULL, "--projector") ) {
+            NEED_VALUE();
+            if ( strcmp(value, "rotate") == 0 ) opt->projector = PROJECT_ROTATE;
+            else if ( strcmp(value, "ray") == 0 ) opt->projector = PROJECT_RAY;
+            else if ( strcmp(value, "fan") == 0 ) opt->projector = PROJECT_FAN;
+            else if ( strcmp(value, "cone") == 0 ) opt->projector = PROJECT_CONE;
+            else { fprintf(stderr, "Unknown projector %s\n", value); return -1; }
+        }
+        else if ( IS(NULL, "--interp") ) {
+            NEED_VALUE();
+            if ( strcmp(value, "nearest") == 0 ) opt->interp = NEAREST;
+            else if ( strcmp(value, "bilinear") == 0 ) opt->interp = BILINEAR;
+            else { fprintf(stderr, "Unknown interpolation %s\n", value); return -1; }
+        }
+        else if ( IS(NULL, "--simd") ) {
+            NEED_VALUE();
+            if ( strcmp(value, "scalar") == 0 ) opt->simd = SIMD_SCALAR;
+            else if ( strcmp(value, "avx2") == 0 ) opt->simd = SIMD_AVX2;
+            else if ( strcmp(value, "avx512") == 0 ) opt->simd = SIMD_AVX512;
+            else { fprintf(stderr, "Unknown SIMD level %s\n", value); return -1; }
+        }
+        else if ( IS(NULL, "--rotation") ) {
+            NEED_VALUE();
+            if ( strcmp(value, "gather") == 0 ) opt->rotation = ROTATION_GATHER;
+            else if ( strcmp(value, "shear") == 0 ) opt->rotation = ROTATION_SHEAR;
+            else if ( strcmp(value, "shear-sinc") == 0 ) opt->rotation = ROTATION_SHEAR_SINC;
+            else { fprintf(stderr, "Unknown rotation %s\n", value); return -1; }
+        }
+        else if ( IS(NULL, "--filter") ) {
+            NEED_VALUE();
+            if ( strcmp(value, "ram-lak") == 0 ) opt->filter = FILTER_RAM_LAK;
+            else if ( strcmp(value, "shepp-logan") == 0 ) opt->filter = FILTER_SHEPP_LOGAN;
+            else if ( strcmp(value, "hann") == 0 ) opt->filter = FILTER_HANN;
+            else { fprintf(stderr, "Unknown filter %s\n", value); return -1; }
+        }
+        else {
+            fprintf(stderr, "Unknown option %s, see --help\n", arg);
+            return -1;
+        }
 
-    int width, height, channels;
-    int width_rot = 0, height_rot = 0;
-    char * filename = "square.png";
-    char output_filename[20];
-    unsigned char *input_image = stbi_load(filename, &width, &height, &channels, 0);
-    int angle_deg, angle_max = 360, angle_delta = 10;
-    int angles = angle_max/angle_delta;
-    int height_sin;
-    enum CHANNELS offset = RED;
-    double angle_rad;
+#undef NEED_VALUE
+#undef IS
+    }
 
-    /* Use as a check for small images */
-    // draw_channel(input_image, width, height, channels, offset);
+    if ( !format_given ) {
+        opt->format = format_from_filename(opt->output_filename);
+    }
+    /* the method fixes the subsets, --subsets only counts those of os-sart, in either order */
+    if ( method && strcmp(method, "os-sart") != 0 && subsets_given ) {
+        fprintf(stderr, "--subsets is for os-sart, sirt uses one subset and sart one per angle\n");
+        return -1;
+    }
+    if ( method && strcmp(method, "sirt") == 0 ) opt->subsets = 1;
+    else if ( method && strcmp(method, "sart") == 0 ) opt->subsets = 0;
+    else if ( method && !subsets_given ) opt->subsets = 10;
+    if ( opt->angle_delta <= 0.0 || opt->angle_end <= opt->angle_start ) {
+        fprintf(stderr, "Angle range must be increasing with a positive step\n");
+        return -1;
+    }
+    if ( opt->projector == PROJECT_FAN && (opt->matrix_filename || opt->volume_filename || opt->reconstruction_filename) ) {
+        fprintf(stderr, "--matrix, --volume and --reconstruct are parallel-beam only, not for the fan projector\n");
+        return -1;
+    }
+    if ( opt->projector == PROJECT_CONE && (!opt->volume_filename || opt->matrix_filename || opt->reconstruction_filename || opt->fan.curved) ) {
+        fprintf(stderr, "The cone projector needs --volume and a flat detector, without --matrix or --reconstruct\n");
+        return -1;
+    }
+    /* the solver's weights are the ray projector's, a rotate sinogram has another detector geometry */
+    if ( opt->iterative && opt->projector != PROJECT_RAY && !opt->matrix_filename ) {
+        fprintf(stderr, "--iterative reconstructs ray projector sinograms, add --projector ray or --matrix FILE\n");
+        return -1;
+    }
+    if ( opt->phantom_name && (opt->batch_path || opt->volume_filename || opt->sinogram_filename || opt->phantom_size <= 0) ) {
+        fprintf(stderr, "--phantom needs a positive --phantom-size and replaces the input image, not --batch, --volume or --sinogram\n");
+        return -1;
+    }
+    if ( opt->iterative && (opt->iterations < 1 || opt->relaxation <= 0.0 || opt->relaxation >= 2.0) ) {
+        fprintf(stderr, "Iterative reconstruction needs at least one iteration and a relaxation between 0 and 2\n");
+        return -1;
+    }
+#ifndef SINOGRAM_TRACE
+    if ( opt->trace_filename ) {
+        fprintf(stderr, "--trace needs a build with -DSINOGRAM_TRACE, see make trace\n");
+        return -1;
+    }
+#endif
+    if ( opt->num_threads < 1 ) opt->num_threads = 1;
+    if ( opt->detectors < 0 ) opt->detectors = 0;
+    return 0;
+}
 
-    /* allocate N bytes for rotated image */
-    // unsigned char* rotated_image = malloc(width*height*channels);
+/* sinogram height for a width x height image, completes the fan geometry, -1 if it is impossible */
+static int detector_count(struct options* opt, int width, int height, struct fan_geometry* fan) {
+    double diagonal = sqrt((double) width*width + (double) height*height);
 
-    // memcpy(rotated_image, input_image, width*height*channels);
-    /* Alternative to MEMCPY: */
-    // for (int i = 0; i < width*height*channels; i++){
-    //     *(rotated_image+i) = *(input_image+i);
-    // }
+    *fan = opt->fan;
+    if ( opt->projector != PROJECT_FAN && opt->projector != PROJECT_CONE ) {
+        return opt->detectors > 0 ? opt->detectors : (int) diagonal;
+    }
 
-    /* compute height for sinogram */
-    height_sin = sqrt(height*height + width*width);
+    if ( fan->sid <= 0.0 ) fan->sid = diagonal;
+    if ( fan->sdd <= 0.0 ) fan->sdd = 2.0*fan->sid;
+    if ( fan->spacing <= 0.0 ) fan->spacing = fan->sdd / fan->sid;
+    if ( fan->sid <= 0.5*diagonal || fan->sdd <= fan->sid ) {
+        fprintf(stderr, "The fan source must be outside the image (sid > %g) and before the detector (sdd > sid)\n", 0.5*diagonal);
+        return -1;
+    }
+    /* the whole fan through the image falls on the detector */
+    return opt->detectors > 0 ? opt->detectors : fan_detectors(fan, width, height);
+}
 
-    /* allocate bytes for sinogram image */
-    unsigned char* sinogram = malloc(angles*height_sin*channels);
+/* map the system matrix in filename, built and saved there first if missing or of another geometry */
+static struct system_matrix* open_matrix(const char* filename, int width, int height, int height_sin, int angles, struct options* opt, struct thread_pool* pool) {
+    struct system_matrix* matrix = system_matrix_load(filename);
 
-    /* clean sinogram */
-    for (int i = 0; i < angles*height_sin*channels; i++){
-            *(sinogram+i) = 0;
+    if ( matrix && !system_matrix_matches(matrix, width, height, height_sin, angles, opt->angle_start, opt->angle_delta) ) {
+        system_matrix_destroy(matrix);
+        matrix = NULL;
+    }
+    if ( !matrix ) {
+        printf("Building system matrix %s\n", filename);
+        matrix = system_matrix_build(width, height, height_sin, angles, opt->angle_start, opt->angle_delta, pool);
+        if ( !matrix ) {
+            fprintf(stderr, "Cannot build the system matrix\n");
+        }
+        else if ( system_matrix_save(matrix, filename) != 0 ) {
+            fprintf(stderr, "Cannot write %s\n", filename);
+        }
     }
+    return matrix;
+}
 
-    for (angle_deg = 0; angle_deg < angle_max; angle_deg += angle_delta) {
-        /* convert to radians */
-        angle_rad = angle_deg * M_PI / 180.0;
+/* project every slice of opt->batch_path into opt->output_dir, returns the number of failed slices */
+static int project_batch(struct options* opt, int angles, struct thread_pool* pool) {
+    struct batch_job batch;
+    int width, height, channels, failed;
 
-        /* compute size of rotated image */
-        size_of_rotated_image(&width_rot, &height_rot, height, width, angle_rad);
+    memset(&batch, 0, sizeof(batch));
+    batch.input_filenames = list_slices(opt->batch_path, &batch.count);
+    if ( !batch.input_filenames ) {
+        fprintf(stderr, "No images in %s\n", opt->batch_path);
+        return 1;
+    }
 
-        /* allocate memory for rotated image */
-        unsigned char* rotated_image = malloc(width_rot*height_rot*channels);
+    /* geometry of the whole batch from the header of the first slice */
+    if ( !stbi_info(batch.input_filenames[0], &width, &height, &channels) ) {
+        fprintf(stderr, "Cannot load %s: %s\n", batch.input_filenames[0], stbi_failure_reason());
+        free_slices(batch.input_filenames, batch.count);
+        return 1;
+    }
+    batch.output_dir = opt->output_dir;
+    batch.format = opt->format;
+    batch.projection = (struct sinogram_job) {
+        .width = width, .height = height, .channels = channels,
+        .angles = angles, .angle_start = opt->angle_start, .angle_delta = opt->angle_delta,
+        .projector = opt->projector, .interp = opt->interp, .rotation = opt->rotation, .symmetry = opt->symmetry
+    };
+    batch.projection.height_sin = detector_count(opt, width, height, &batch.projection.fan);
+    if ( batch.projection.height_sin <= 0 ) {
+        free_slices(batch.input_filenames, batch.count);
+        return 1;
+    }
 
-        /* set black image */
-        for (int i = 0; i < width_rot*height_rot*channels; i++){
-            *(rotated_image+i) = 0;
+    /* ray weights or rotated image buffers, set up once for all slices */
+    if ( opt->matrix_filename ) {
+        batch.matrix = open_matrix(opt->matrix_filename, width, height, batch.projection.height_sin, angles, opt, pool);
+        if ( !batch.matrix ) {
+            free_slices(batch.input_filenames, batch.count);
+            return 1;
         }
-
-        /* loop through all image channels */
-        for ( int c = 0; c < NUM_CHANNELS; c++ ) {
-            rotate_image(rotated_image, input_image, angle_rad, width, height, width_rot, height_rot, channels, (enum CHANNELS)c);
+    }
+    else if ( opt->projector == PROJECT_ROTATE ) {
+        batch.projection.scratch = scratch_create(pool_size(pool), rotation_scratch_bound(width, height, channels, opt->rotation));
+        if ( !batch.projection.scratch ) {
+            fprintf(stderr, "Cannot allocate the rotated image buffers\n");
+            free_slices(batch.input_filenames, batch.count);
+            return 1;
         }
+    }
 
-        /* fill sinogram with current rotated image */
-        fill_sinogram(sinogram, height_sin, angles, rotated_image, width_rot, height_rot, channels, angle_deg, angle_delta);
-
-        sprintf(output_filename, "rotated%d.png", angle_deg);
-        printf("%s\n", output_filename);
+    failed = run_batch(&batch, pool);
+    printf("Projected %d of %d slices\n", batch.count - failed, batch.count);
 
-        /* save rotated image */
-        stbi_write_png(output_filename, width_rot, height_rot, channels, rotated_image, width_rot*channels);
+    system_matrix_destroy(batch.matrix);
+    scratch_destroy(batch.projection.scratch);
+    free_slices(batch.input_filenames, batch.count);
+    return failed;
+}
 
-        free(rotated_image);
+/* cone-beam projection of the whole volume, loaded into memory */
+static int project_cone_volume(struct options* opt, struct volume_source* volume, int angles, struct thread_pool* pool) {
+    struct fan_geometry cone;
+    struct brick_volume* bricks;
+    int det_cols, det_rows = opt->detector_rows;
+    double rays_per_second;
+    int status;
+
+    det_cols = detector_count(opt, volume->width, volume->height, &cone);
+    if ( det_cols <= 0 ) return -1;
+    cone_detector_size(&cone, volume->width, volume->height, volume->depth, &det_cols, &det_rows);
+
+    bricks = brick_volume_load(volume);
+    if ( !bricks ) {
+        fprintf(stderr, "Cannot load volume %s\n", opt->volume_filename);
+        return -1;
     }
-    
-    stbi_image_free(input_image);
-    
-    stbi_write_png("sinogram.png", angles, height_sin, channels, sinogram, (angles/angle_deg)*channels);
+    status = project_cone(bricks, opt->output_filename, opt->format, &cone, det_cols, det_rows, angles, opt->angle_start, opt->angle_delta, pool, &rays_per_second);
+    if ( status == 0 ) {
+        printf("%d projections of %dx%d, %.3g rays/s\n", angles, det_cols, det_rows, rays_per_second);
+    }
+    brick_volume_destroy(bricks);
+    return status;
+}
 
-    free(sinogram);
+/* projection of the volume opt->volume_filename into opt->output_filename, returns 0 on success */
+static int project_volume_file(struct options* opt, int angles, struct thread_pool* pool) {
+    const char* ext = strrchr(opt->volume_filename, '.');
+    struct volume_source* volume;
+    int height_sin, status;
 
-    cpu_time_used = ((double) (clock() - start_time)) / CLOCKS_PER_SEC;
-    printf("Program took %f seconds to execute.\n", cpu_time_used);
+    if ( opt->format != FORMAT_NPY32 && opt->format != FORMAT_RAW32 ) {
+        fprintf(stderr, "Volume projections are written as npy32 or raw32, not to %s\n", opt->output_filename);
+        return -1;
+    }
+    if ( ext && (strcmp(ext, ".nrrd") == 0 || strcmp(ext, ".nhdr") == 0) ) {
+        volume = volume_open_nrrd(opt->volume_filename);
+    }
+    else if ( opt->volume_width > 0 ) {
+        volume = volume_open_raw(opt->volume_filename, opt->volume_width, opt->volume_height, opt->volume_depth, opt->volume_type, opt->volume_big_endian, 0);
+    }
+    else {
+        fprintf(stderr, "A raw volume needs --volume-size WxHxD\n");
+        return -1;
+    }
+    if ( !volume ) {
+        fprintf(stderr, "Cannot open volume %s\n", opt->volume_filename);
+        return -1;
+    }
 
-    // getchar();
-    return 0;
+    if ( opt->projector == PROJECT_CONE ) {
+        status = project_cone_volume(opt, volume, angles, pool);
+    }
+    else {
+        height_sin = opt->detectors > 0 ? opt->detectors : (int) sqrt((double) volume->width*volume->width + (double) volume->height*volume->height);
+        status = project_volume(volume, opt->output_filename, opt->format, height_sin, angles, opt->angle_start, opt->angle_delta, opt->slab, pool);
+    }
+    if ( status != 0 ) {
+        fprintf(stderr, "Cannot project volume %s into %s\n", opt->volume_filename, opt->output_filename);
+    }
+    volume_close(volume);
+    return status;
 }
 
-void draw_channel(unsigned char* input_image, int width, int height, int channels, enum CHANNELS offset) {
-    int N = width*height;
-    int pixel_num = 0;
-    int val = 0;
+/* clamp the reconstruction to 8 bits and write it as PNG */
+static int write_reconstruction(const char* filename, float* reconstruction, int width, int height, int channels) {
+    unsigned char* reconstruction_image = malloc((size_t) width*height*channels);
+    int ok;
 
-    for (; pixel_num < N; pixel_num++) {
-            val = *(input_image + channels*pixel_num + offset);
-            
-            if ( pixel_num % width == 0) {
-                printf("\n");
-            }
-            if ( val < 10 ) printf("%d   ", val);
-            else if ( val < 100 ) printf("%d  ", val);
-            else printf("%d ", val);
-        }
+    if ( !reconstruction_image ) return -1;
+    for (int i = 0; i < width*height*channels; i++) {
+        float val = reconstruction[i];
+        reconstruction_image[i] = val < 0.0f ? 0 : val > 255.0f ? 255 : (unsigned char) (val + 0.5f);
+    }
+    ok = stbi_write_png(filename, width, height, channels, reconstruction_image, width*channels);
+    free(reconstruction_image);
+    return ok ? 0 : -1;
 }
 
-void size_of_rotated_image(int* width_rot, int* height_rot, int height, int width, double angle) {
-    double x[4], y[4];
-    double x_rot[4], y_rot[4];
+/* SIRT or SART reconstruction from zero with the matrix of opt->matrix_filename or one built for the run, returns 0 on success */
+static int reconstruct_iterative(struct options* opt, float* reconstruction, int width, int height, const float* sinogram, int angles, int height_sin, int channels, struct thread_pool* pool) {
+    struct system_matrix* matrix;
+    struct iterative_solver* solver;
 
-    /* define 4 corners */
-    x[0] = -0.5*(double)width;
-    x[1] = -x[0];
-    x[2] = x[1];
-    x[3] = x[0];
+    if ( opt->matrix_filename ) matrix = open_matrix(opt->matrix_filename, width, height, height_sin, angles, opt, pool);
+    else matrix = system_matrix_build(width, height, height_sin, angles, opt->angle_start, opt->angle_delta, pool);
+    if ( !matrix ) return -1;
 
-    y[0] = 0.5*(double)height;
-    y[1] = y[0];
-    y[2] = -y[1];
-    y[3] = y[2];
+    solver = iterative_create(matrix, opt->subsets, opt->subset_order, channels, pool);
+    if ( !solver ) {
+        system_matrix_destroy(matrix);
+        return -1;
+    }
+    memset(reconstruction, 0, (size_t) width*height*channels*sizeof(float));
+    iterative_run(solver, reconstruction, sinogram, opt->iterations, opt->relaxation);
 
-    /* find rotated positions */
-    x_rot[0] = x[0] * cos(angle) - y[0] * sin(angle);
-    y_rot[0] = x[0] * sin(angle) + y[0] * cos(angle);
+    iterative_destroy(solver);
+    system_matrix_destroy(matrix);
+    return 0;
+}
 
-    x_rot[1] = x[1] * cos(angle) - y[1] * sin(angle);
-    y_rot[1] = x[1] * sin(angle) + y[1] * cos(angle);
+/* opt->phantom_name rasterized, one channel, 4x4 samples per pixel against aliased edges */
+static unsigned char* load_phantom(struct options* opt, int* width, int* height, int* channels) {
+    struct phantom* phantom = phantom_named(opt->phantom_name);
+    unsigned char* image;
 
-    x_rot[2] = x[2] * cos(angle) - y[2] * sin(angle);
-    y_rot[2] = x[2] * sin(angle) + y[2] * cos(angle);
+    if ( !phantom ) {
+        fprintf(stderr, "Unknown phantom %s\n", opt->phantom_name);
+        return NULL;
+    }
+    *width = *height = opt->phantom_size;
+    *channels = 1;
+    image = malloc((size_t) *width * *height);
+    if ( !image || phantom_rasterize_u8(phantom, image, *width, *height, 1, 4) != 0 ) {
+        fprintf(stderr, "Cannot allocate the %dx%d phantom\n", *width, *height);
+        free(image);
+        image = NULL;
+    }
+    phantom_destroy(phantom);
+    return image;
+}
 
-    x_rot[3] = x[3] * cos(angle) - y[3] * sin(angle);
-    y_rot[3] = x[3] * sin(angle) + y[3] * cos(angle);
+/* compare a projected phantom with its exact parallel-beam sinogram */
+static void report_phantom_error(struct options* opt, const float* sinogram, int width, int height, int height_sin, int angles) {
+    struct phantom* phantom = phantom_named(opt->phantom_name);
+    long N = (long) angles*height_sin;
+    float* exact = malloc(N*sizeof(float));
+    double max_error = 0.0, max_exact = 0.0, error2 = 0.0, exact2 = 0.0;
+
+    if ( phantom && exact ) {
+        phantom_radon(phantom, exact, width, height, 1, height_sin, angles, opt->angle_start, opt->angle_delta);
+        for (long i = 0; i < N; i++) {
+            double e = fabs(sinogram[i] - exact[i]);
+            if ( e > max_error ) max_error = e;
+            if ( exact[i] > max_exact ) max_exact = exact[i];
+            error2 += e*e;
+            exact2 += (double) exact[i]*exact[i];
+        }
+        printf("Error against the exact sinogram: max %g (%.3f%% of its peak), relative RMS %.4f%%\n",
+               max_error, max_exact > 0.0 ? 100.0*max_error / max_exact : 0.0, exact2 > 0.0 ? 100.0*sqrt(error2 / exact2) : 0.0);
+    }
+    free(exact);
+    phantom_destroy(phantom);
+}
 
-    /* get maximum width and height */
-    *(width_rot) = (int) 2 * round( fmax( fmax(abs(x_rot[0]), abs(x_rot[1])), fmax(abs(x_rot[2]), abs(x_rot[3])) ) );
-    *(height_rot) = (int) 2 * round( fmax( fmax(abs(y_rot[0]), abs(y_rot[1])), fmax(abs(y_rot[2]), abs(y_rot[3])) ) );
+/* timing report at the end of a run */
+static void finish(struct options* opt, double start_time) {
+    printf("Program took %f seconds to execute.\n", monotonic_seconds() - start_time);
+    if ( opt->trace_filename && trace_export(opt->trace_filename) != 0 ) {
+        fprintf(stderr, "Cannot write %s\n", opt->trace_filename);
+    }
 }
 
-void rotate_image(unsigned char* rotated_image, unsigned char* input_image, double angle, int width, int height, int width_rot, int height_rot, int channels, enum CHANNELS offset) {
-    int pixel_num;
-    int N = width_rot*height_rot;
-    double x,y;
-    unsigned char val;
+int main(int argc, char** argv) {
+    double start_time;
+    struct options opt;
+    int status;
+    
+    /* wall time, clock() would add up the CPU time of all worker threads */
+    start_time = monotonic_seconds();
+
+    status = parse_options(&opt, argc, argv);
+    if ( status != 0 ) return status > 0 ? 0 : 1;
+    limit_simd_level(opt.simd);
 
-    for (pixel_num = 0; pixel_num < N; pixel_num++) {
-        // 1. find rotated position
-        rotate_position(&x, &y, pixel_num, angle, width_rot, height_rot, width, height);
+    int width, height, channels;
+    unsigned char *input_image = NULL;
+    int angles = (int) ceil((opt.angle_end - opt.angle_start) / opt.angle_delta - 1e-9);
+    int height_sin;
+    float* sinogram;
 
-        // 2. compute value (NEAREST)
-        val = nearest_neighbour(input_image, x, y, width, height, channels, offset);
-        // val = bilinear_interp(input_image, x, y, width, height, channels, offset);
+    struct thread_pool* pool = pool_create(opt.num_threads);
 
-        // 3. assign value
-        *(rotated_image + channels*pixel_num + offset) = val;
+    if ( opt.volume_filename || opt.batch_path ) {
+        if ( opt.volume_filename ) status = project_volume_file(&opt, angles, pool) != 0;
+        else status = project_batch(&opt, angles, pool) != 0;
+        pool_destroy(pool);
+        finish(&opt, start_time);
+        return status;
     }
-}
 
-void rotate_position(double* x, double* y, int pixel_num, double angle, int width_rot, int height_rot, int width, int height) {
-    double x_rot, y_rot;
-    
-    /* compute pixel position*/
-    *x = pixel_num % width_rot;
-    *y = pixel_num / width_rot;
+    if ( opt.sinogram_filename ) {
+        /* reconstruct an existing sinogram, its width must match the angle settings */
+        int sinogram_angles;
+        sinogram = read_sinogram(opt.sinogram_filename, &sinogram_angles, &height_sin, &channels);
+        if ( !sinogram ) {
+            fprintf(stderr, "Cannot read sinogram %s\n", opt.sinogram_filename);
+            pool_destroy(pool);
+            return 1;
+        }
+        if ( sinogram_angles != angles ) {
+            fprintf(stderr, "Sinogram has %d angles, the angle settings give %d\n", sinogram_angles, angles);
+            free(sinogram);
+            pool_destroy(pool);
+            return 1;
+        }
+        /* largest square the detector covers at every angle */
+        width = opt.width > 0 ? opt.width : (int) ceil(height_sin / sqrt(2.0));
+        height = opt.height > 0 ? opt.height : width;
+        if ( !opt.reconstruction_filename ) opt.reconstruction_filename = "reconstruction.png";
+    }
+    else {
+        TRACE_BEGIN(load_time);
+        if ( opt.phantom_name ) {
+            /* allocated with malloc, which stbi_image_free() also uses */
+            input_image = load_phantom(&opt, &width, &height, &channels);
+        }
+        else {
+            input_image = stbi_load(opt.input_filename, &width, &height, &channels, 0);
+            if ( !input_image ) fprintf(stderr, "Cannot load %s: %s\n", opt.input_filename, stbi_failure_reason());
+        }
+        TRACE_END(load_time, "load", 0);
+        if ( !input_image ) {
+            pool_destroy(pool);
+            return 1;
+        }
 
-    /* center around middle of image */
-    *x = *x - 0.5*width_rot;
-    *y = *y - 0.5*height_rot;
+        /* compute height for sinogram */
+        struct fan_geometry fan;
+        height_sin = detector_count(&opt, width, height, &fan);
+        if ( height_sin <= 0 ) {
+            stbi_image_free(input_image);
+            pool_destroy(pool);
+            return 1;
+        }
 
-    /* compute pixel position after rotation */
-    x_rot = (*x) * cos(angle) - (*y) * sin(angle);
-    y_rot = (*x) * sin(angle) + (*y) * cos(angle);
-    
-    /* move origin back to (0,0) in coords of input image*/
-    x_rot = x_rot + 0.5*width;
-    y_rot = y_rot + 0.5*height;
+        /* allocate clean sinogram, accumulated as float line integrals */
+        sinogram = calloc((long) angles*height_sin*channels, sizeof(float));
+        if ( !sinogram ) {
+            fprintf(stderr, "Cannot allocate the %dx%d sinogram\n", angles, height_sin);
+            stbi_image_free(input_image);
+            pool_destroy(pool);
+            return 1;
+        }
 
-    *x = x_rot;
-    *y = y_rot;
-}
+        TRACE_BEGIN(project_time);
+        if ( opt.matrix_filename ) {
+            /* repeated projections of one geometry are a sparse matrix-vector product */
+            struct system_matrix* matrix = open_matrix(opt.matrix_filename, width, height, height_sin, angles, &opt, pool);
+            if ( !matrix ) {
+                stbi_image_free(input_image);
+                free(sinogram);
+                pool_destroy(pool);
+                return 1;
+            }
+            system_matrix_project(matrix, sinogram, input_image, channels, pool);
+            system_matrix_destroy(matrix);
+        }
+        else {
+            /* rotated image buffers for all workers, allocated once for the worst angle */
+            struct scratch_arena* scratch = NULL;
+            if ( opt.projector == PROJECT_ROTATE ) {
+                scratch = scratch_create(pool_size(pool), rotation_scratch_bound(width, height, channels, opt.rotation));
+                if ( !scratch ) {
+                    fprintf(stderr, "Cannot allocate the rotated image buffers\n");
+                    stbi_image_free(input_image);
+                    free(sinogram);
+                    pool_destroy(pool);
+                    return 1;
+                }
+            }
 
-void fill_sinogram(unsigned char* sinogram, int height_sin, int angles, unsigned char* rotated_image, int width_rot, int height_rot, int channels, int angle_deg, int angle_delta) {
-    int pixel_num = 0;
-    int projection = 0;
-    int offset = 0;
-    int projection_offset = 0;
-
-    /* compute shift of the projection center relative to sinogram center (in height direction) */
-    projection_offset = (height_sin - height_rot) / 2;
-
-    /* for every channel ... */
-    for ( offset = 0; offset < NUM_CHANNELS; offset++ ) {
-        /* ... for every row ... */
-        for (int row = 0; row < height_rot; row++) {
-            /* ... project current row of rotated image ... */
-            for (int col = 0; col < width_rot; col++) {
-                pixel_num = col + row*width_rot;
-                projection += *(rotated_image + channels*pixel_num + offset);
+            /* rotated images are only written on request, off the projection threads */
+            struct dump_writer* dumps = NULL;
+            if ( opt.save_rotated && opt.projector == PROJECT_ROTATE ) {
+                dumps = dump_writer_create(DUMP_QUEUE_LENGTH, opt.dump_compression);
+                if ( !dumps ) {
+                    fprintf(stderr, "Cannot enable the rotated image dumps\n");
+                    scratch_destroy(scratch);
+                    stbi_image_free(input_image);
+                    free(sinogram);
+                    pool_destroy(pool);
+                    return 1;
+                }
             }
-            projection /= height_sin; // scale to maintain value within unsigned char range
-            /* was previously normalized with width_rot but was non-uniform width changes with rotation */ 
 
-            /* ... compute coresponding sinogram pixel */
-            pixel_num = (angle_deg/angle_delta) + (row + projection_offset)*angles; // analogue of: col_sin + row*width_sin
-            
-            /* ... and update sinogram with projection */
-            *(sinogram + channels*pixel_num + offset) = projection;
-            projection = 0;
+            /* project all angles, spread over the worker threads */
+            struct sinogram_job job = {
+                .input_image = input_image, .width = width, .height = height, .channels = channels,
+                .sinogram = sinogram, .height_sin = height_sin, .angles = angles,
+                .angle_start = opt.angle_start, .angle_delta = opt.angle_delta,
+                .projector = opt.projector, .interp = opt.interp, .rotation = opt.rotation, .fan = fan, .scratch = scratch, .dumps = dumps,
+                .symmetry = opt.symmetry
+            };
+            project_all_angles(&job, pool);
+            dump_writer_destroy(dumps);
+            scratch_destroy(scratch);
         }
-    }
-}
-
-unsigned char nearest_neighbour(unsigned char* input_image, double x, double y, int width, int height, int channels, enum CHANNELS offset) {
-    int pixel_num;
-    unsigned char val = 0;
+        TRACE_END(project_time, "project", angles);
 
-    /* outside image case */
-    if ( x < 0.0 || y < 0.0 || x > (width-1) || y > (height-1) ) {
-        return val;
+        /* fan-beam bins are not the parallel rays of the exact sinogram */
+        if ( opt.phantom_name && opt.projector != PROJECT_FAN ) {
+            report_phantom_error(&opt, sinogram, width, height, height_sin, angles);
+        }
+        
+        stbi_image_free(input_image);
+        
+        TRACE_BEGIN(write_time);
+        if ( write_sinogram(opt.output_filename, sinogram, angles, height_sin, channels, opt.format) != 0 ) {
+            fprintf(stderr, "Cannot write %s\n", opt.output_filename);
+            status = 1;
+        }
+        TRACE_END(write_time, "write_sinogram", angles);
     }
 
-    x = round(x);
-    y = round(y);
-    pixel_num = x + y*width;
-    val = *(input_image + channels*pixel_num + offset); 
-    return val;
-}
+    /* filtered back-projection or iterative reconstruction of the sinogram */
+    if ( opt.reconstruction_filename ) {
+        float* reconstruction = malloc((long) width*height*channels*sizeof(float));
+        int reconstructed = 1;
 
-unsigned char bilinear_interp(unsigned char* input_image, double x, double y, int width, int height, int channels, enum CHANNELS offset) {
-    int pixel_num;
-    unsigned char val = 0;
-    float val1, val2, val3, val4;
-    float val12, val34;
+        if ( !reconstruction ) {
+            fprintf(stderr, "Cannot allocate the %dx%d reconstruction\n", width, height);
+            pool_destroy(pool);
+            free(sinogram);
+            return 1;
+        }
+        TRACE_BEGIN(reconstruct_time);
+        if ( opt.iterative ) {
+            if ( reconstruct_iterative(&opt, reconstruction, width, height, sinogram, angles, height_sin, channels, pool) != 0 ) {
+                fprintf(stderr, "Cannot set up the iterative reconstruction\n");
+                reconstructed = 0;
+                status = 1;
+            }
+            TRACE_END(reconstruct_time, "reconstruct_iterative", opt.iterations);
+        }
+        else {
+            if ( reconstruct_fbp(reconstruction, width, height, sinogram, angles, height_sin, channels, opt.angle_start, opt.angle_delta, opt.filter, opt.matrix_filename ? PROJECT_RAY : opt.projector, pool) != 0 ) {
+                fprintf(stderr, "Cannot allocate the filtered back-projection buffers\n");
+                reconstructed = 0;
+                status = 1;
+            }
+            TRACE_END(reconstruct_time, "reconstruct_fbp", angles);
+        }
+        if ( reconstructed && write_reconstruction(opt.reconstruction_filename, reconstruction, width, height, channels) != 0 ) {
+            fprintf(stderr, "Cannot write %s\n", opt.reconstruction_filename);
+            status = 1;
+        }
 
-    /* outside image case */
-    if ( x < 0.0 || y < 0.0 || x > (width-1) || y > (height-1) ) {
-        return val;
+        free(reconstruction);
+        release_filter_spectra();
     }
+    pool_destroy(pool);
 
-    /* left top corner */
-    pixel_num = floor(x) + floor(y)*width;
-    val1 = (float) *(input_image + channels*(pixel_num) + offset);
+    free(sinogram);
 
-    /* right top corner */
-    pixel_num = ceil(x) + floor(y)*width;
-    val2 = (float) *(input_image + channels*pixel_num + offset);
-    
-    /* left bottom corner */
-    pixel_num = floor(x) + ceil(y)*width;
-    val3 = (float) *(input_image + channels*pixel_num + offset);
-    
-    /* right bottom corner*/
-    pixel_num = ceil(x) + ceil(y)*width;
-    val4 = (float) *(input_image + channels*pixel_num + offset);
-    
-    /* for pixel grid the denominator (x2-x1) = 1 */
-    val12 = val1 + (val2-val1)*(x-floor(x));
-    val34 = val3 + (val4-val3)*(x-floor(x));
+    finish(&opt, start_time);
 
-    val = (unsigned char) round( val12 + (val34-val12)*(y-floor(y)) );
-    return val;
-}
\ No newline at end of file
+    // getchar();
+    return status;
+}
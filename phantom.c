@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sinogram.h"
+#include "phantom.h"
+
+/*
+ * Both rasterizing and projecting come down to intersecting a line with a convex shape.
+ * A raster row is a horizontal line, so each shape covers one run of samples of it and
+ * is added span by span, without an inside test per pixel; a sinogram bin is the line of
+ * project_rays() and the chord length times the shape value is its exact integral.
+ */
+
+/* modified Shepp-Logan, y and angles flipped from the usual y-up table, values scaled to 8 bit */
+static const struct phantom_shape shepp_logan[] = {
+    { SHAPE_ELLIPSE,  0.0,    0.0,    0.69,   0.92,    0.0,  255.0 },
+    { SHAPE_ELLIPSE,  0.0,    0.0184, 0.6624, 0.874,   0.0, -204.0 },
+    { SHAPE_ELLIPSE,  0.22,   0.0,    0.11,   0.31,   18.0,  -51.0 },
+    { SHAPE_ELLIPSE, -0.22,   0.0,    0.16,   0.41,  -18.0,  -51.0 },
+    { SHAPE_ELLIPSE,  0.0,   -0.35,   0.21,   0.25,    0.0,   25.5 },
+    { SHAPE_ELLIPSE,  0.0,   -0.1,    0.046,  0.046,   0.0,   25.5 },
+    { SHAPE_ELLIPSE,  0.0,    0.1,    0.046,  0.046,   0.0,   25.5 },
+    { SHAPE_ELLIPSE, -0.08,   0.605,  0.046,  0.023,   0.0,   25.5 },
+    { SHAPE_ELLIPSE,  0.0,    0.605,  0.023,  0.023,   0.0,   25.5 },
+    { SHAPE_ELLIPSE,  0.06,   0.605,  0.023,  0.046,   0.0,   25.5 },
+};
+
+static const struct phantom_shape ellipses[] = {
+    { SHAPE_ELLIPSE,  0.0,    0.0,    0.9,    0.7,     0.0,  100.0 },
+    { SHAPE_ELLIPSE,  0.3,   -0.2,    0.25,   0.15,   30.0,   80.0 },
+    { SHAPE_ELLIPSE, -0.35,   0.25,   0.2,    0.1,   -45.0,  120.0 },
+    { SHAPE_ELLIPSE,  0.0,    0.45,   0.08,   0.08,    0.0,  -60.0 },
+    { SHAPE_ELLIPSE, -0.1,   -0.4,    0.3,    0.05,   10.0,   60.0 },
+};
+
+static const struct phantom_shape rectangles[] = {
+    { SHAPE_RECTANGLE,  0.0,  0.0,    0.8,    0.6,     0.0,   80.0 },
+    { SHAPE_RECTANGLE,  0.3,  0.2,    0.2,    0.1,    30.0,  100.0 },
+    { SHAPE_RECTANGLE, -0.4, -0.2,    0.15,   0.3,   -20.0,  120.0 },
+    { SHAPE_RECTANGLE,  0.0,  0.0,    0.05,   0.5,    45.0,  -50.0 },
+    { SHAPE_ELLIPSE,    0.5, -0.4,    0.1,    0.1,     0.0,  150.0 },
+};
+
+struct phantom* phantom_create(void) {
+    return calloc(1, sizeof(struct phantom));
+}
+
+int phantom_add(struct phantom* phantom, enum SHAPE type, double x, double y, double a, double b, double angle_deg, double value) {
+    if ( phantom->count == phantom->capacity ) {
+        int capacity = phantom->capacity ? 2*phantom->capacity : 16;
+        struct phantom_shape* grown = realloc(phantom->shapes, capacity*sizeof(*grown));
+        if ( !grown ) return -1;
+        phantom->shapes = grown;
+        phantom->capacity = capacity;
+    }
+    phantom->shapes[phantom->count++] = (struct phantom_shape) { type, x, y, a, b, angle_deg, value };
+    return 0;
+}
+
+struct phantom* phantom_named(const char* name) {
+    const struct phantom_shape* shapes;
+    struct phantom* phantom;
+    size_t count;
+
+    if ( strcmp(name, "shepp-logan") == 0 ) { shapes = shepp_logan; count = sizeof(shepp_logan) / sizeof(shepp_logan[0]); }
+    else if ( strcmp(name, "ellipses") == 0 ) { shapes = ellipses; count = sizeof(ellipses) / sizeof(ellipses[0]); }
+    else if ( strcmp(name, "rectangles") == 0 ) { shapes = rectangles; count = sizeof(rectangles) / sizeof(rectangles[0]); }
+    else return NULL;
+
+    phantom = phantom_create();
+    for (size_t i = 0; phantom && i < count; i++) {
+        const struct phantom_shape* s = &shapes[i];
+        if ( phantom_add(phantom, s->type, s->x, s->y, s->a, s->b, s->angle_deg, s->value) != 0 ) {
+            phantom_destroy(phantom);
+            return NULL;
+        }
+    }
+    return phantom;
+}
+
+void phantom_destroy(struct phantom* phantom) {
+    if ( !phantom ) return;
+    free(phantom->shapes);
+    free(phantom);
+}
+
+/* range of t where |p + t*d| <= 1 on one axis, narrowing [t0, t1] */
+static int clip_unit(double p, double d, double* t0, double* t1) {
+    if ( d == 0.0 ) return p >= -1.0 && p <= 1.0;
+
+    double lo = (-1.0 - p) / d, hi = (1.0 - p) / d;
+    if ( lo > hi ) { double tmp = lo; lo = hi; hi = tmp; }
+    if ( lo > *t0 ) *t0 = lo;
+    if ( hi < *t1 ) *t1 = hi;
+    return *t0 < *t1;
+}
+
+/*
+ * Parameter range [t0, t1] of the line (px,py) + t*(dx,dy) inside shape, in centered pixel
+ * coordinates where the normalized unit is scale pixels. Returns 0 if the line misses it.
+ */
+static int shape_chord(const struct phantom_shape* shape, double scale, double px, double py, double dx, double dy, double* t0, double* t1) {
+    double angle = shape->angle_deg * M_PI / 180.0;
+    double c = cos(angle), s = sin(angle);
+    double a = shape->a*scale, b = shape->b*scale;
+    double rx = px - shape->x*scale, ry = py - shape->y*scale;
+
+    /* into the shape's frame with its half extents scaled to 1 */
+    double lx = (rx*c + ry*s) / a, ly = (-rx*s + ry*c) / b;
+    double ldx = (dx*c + dy*s) / a, ldy = (-dx*s + dy*c) / b;
+
+    if ( shape->type == SHAPE_RECTANGLE ) {
+        *t0 = -HUGE_VAL;
+        *t1 = HUGE_VAL;
+        return clip_unit(lx, ldx, t0, t1) && clip_unit(ly, ldy, t0, t1);
+    }
+
+    /* unit circle: |l + t*ld|^2 = 1 */
+    double qa = ldx*ldx + ldy*ldy;
+    double qb = lx*ldx + ly*ldy;
+    double qc = lx*lx + ly*ly - 1.0;
+    double disc = qb*qb - qa*qc;
+    if ( disc <= 0.0 ) return 0;
+    disc = sqrt(disc);
+    *t0 = (-qb - disc) / qa;
+    *t1 = (-qb + disc) / qa;
+    return 1;
+}
+
+/* one image row as the mean of oversample sample rows of oversample samples per pixel */
+static void rasterize_row(const struct phantom* phantom, float* pixels, float* samples, int row, int width, int height, int oversample) {
+    double scale = 0.5*(width < height ? width : height);
+    int n = width*oversample;
+    float weight = 1.0f / (oversample*oversample);
+    double t0, t1;
+
+    memset(pixels, 0, width*sizeof(float));
+    for (int sub = 0; sub < oversample; sub++) {
+        double y = row + (sub + 0.5) / oversample - 0.5*height;
+
+        memset(samples, 0, n*sizeof(float));
+        for (int i = 0; i < phantom->count; i++) {
+            const struct phantom_shape* shape = &phantom->shapes[i];
+            if ( !shape_chord(shape, scale, 0.0, y, 1.0, 0.0, &t0, &t1) ) continue;
+
+            /* samples k at x = (k + 0.5)/oversample - width/2 inside [t0, t1] */
+            double first = ceil((t0 + 0.5*width)*oversample - 0.5);
+            double last = floor((t1 + 0.5*width)*oversample - 0.5);
+            int k0 = first < 0.0 ? 0 : (int) first;
+            int k1 = last > n - 1 ? n - 1 : (int) last;
+            float value = (float) shape->value;
+            for (int k = k0; k <= k1; k++) {
+                samples[k] += value;
+            }
+        }
+        for (int k = 0; k < n; k++) {
+            pixels[k / oversample] += weight*samples[k];
+        }
+    }
+}
+
+int phantom_rasterize_u8(const struct phantom* phantom, unsigned char* image, int width, int height, int channels, int oversample) {
+    if ( oversample < 1 ) oversample = 1;
+    float* samples = malloc((size_t) width*oversample*sizeof(float));
+    float* pixels = malloc(width*sizeof(float));
+
+    if ( !samples || !pixels ) {
+        free(pixels);
+        free(samples);
+        return -1;
+    }
+    for (int row = 0; row < height; row++) {
+        unsigned char* out = image + (size_t) row*width*channels;
+
+        rasterize_row(phantom, pixels, samples, row, width, height, oversample);
+        for (int col = 0; col < width; col++) {
+            float v = pixels[col] + 0.5f;
+            unsigned char pixel = v <= 0.0f ? 0 : v >= 255.0f ? 255 : (unsigned char) v;
+            for (int c = 0; c < channels; c++) {
+                out[col*channels + c] = pixel;
+            }
+        }
+    }
+    free(pixels);
+    free(samples);
+    return 0;
+}
+
+double phantom_line_integral(const struct phantom* phantom, int width, int height, double s, double angle_rad) {
+    double scale = 0.5*(width < height ? width : height);
+    double cos_a = cos(angle_rad), sin_a = sin(angle_rad);
+    double sum = 0.0, t0, t1;
+
+    /* the ray of detector_ray(): through s*(-sin, cos) along (cos, sin) */
+    for (int i = 0; i < phantom->count; i++) {
+        if ( shape_chord(&phantom->shapes[i], scale, -s*sin_a, s*cos_a, cos_a, sin_a, &t0, &t1) ) {
+            sum += phantom->shapes[i].value * (t1 - t0);
+        }
+    }
+    return sum;
+}
+
+void phantom_radon(const struct phantom* phantom, float* sinogram, int width, int height, int channels, int height_sin, int angles, double angle_start, double angle_delta) {
+    for (int a = 0; a < angles; a++) {
+        double angle_rad = (angle_start + a*angle_delta) * M_PI / 180.0;
+        float* projection = sinogram + (long) a*height_sin*channels;
+
+        for (int det = 0; det < height_sin; det++) {
+            float value = (float) phantom_line_integral(phantom, width, height, det + 0.5 - 0.5*height_sin, angle_rad);
+            for (int c = 0; c < channels; c++) {
+                projection[det*channels + c] = value;
+            }
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef PHANTOM_H
+#define PHANTOM_H
+
+/*
+ * Analytic phantoms.
+ *
+ * A phantom is a sum of constant-valued ellipses and rectangles in normalized image
+ * coordinates: x to the right and y down, like rows, -1..1 across the shorter image side
+ * with the image center at 0. Overlapping shapes add up. The same description is
+ * rasterized at any size and projected exactly: the line integral through a convex
+ * shape is its value times the chord length, so phantom_radon() is the ground truth the
+ * discrete projectors approximate, in the geometry and units of project_rays().
+ */
+
+enum SHAPE { SHAPE_ELLIPSE, SHAPE_RECTANGLE };
+
+struct phantom_shape {
+    enum SHAPE type;
+    double x, y;                    /* center */
+    double a, b;                    /* half extents along the shape's own x and y axes */
+    double angle_deg;               /* rotation from the image x axis towards y */
+    double value;                   /* added inside the shape, 8-bit pixel units */
+};
+
+struct phantom {
+    int count, capacity;
+    struct phantom_shape* shapes;
+};
+
+struct phantom* phantom_create(void);
+
+/* returns 0, or -1 if out of memory */
+int phantom_add(struct phantom* phantom, enum SHAPE type, double x, double y, double a, double b, double angle_deg, double value);
+
+/* "shepp-logan" (the modified, higher contrast version), "ellipses" or "rectangles", NULL if unknown */
+struct phantom* phantom_named(const char* name);
+
+void phantom_destroy(struct phantom* phantom);
+
+/* width x height pixels, every pixel the mean of oversample^2 point samples rounded and clamped to 0..255,
+   copied to every channel; returns 0, or -1 if out of memory */
+int phantom_rasterize_u8(const struct phantom* phantom, unsigned char* image, int width, int height, int channels, int oversample);
+
+/* exact line integral along the parallel ray of detector offset s (pixels from the center) at angle_rad */
+double phantom_line_integral(const struct phantom* phantom, int width, int height, double s, double angle_rad);
+
+/* projection-major sinogram of the phantom rasterized at width x height, as filled by project_rays() */
+void phantom_radon(const struct phantom* phantom, float* sinogram, int width, int height, int channels, int height_sin, int angles, double angle_start, double angle_delta);
+
+#endif
@@ -0,0 +1,224 @@
+#include <math.h>
+#include "sinogram.h"
+
+/*
+ * Ray-driven projector.
+ *
+ * Instead of rotating the whole image and summing its rows, every sinogram bin is
+ * computed as a line integral straight through the input image (Joseph's method):
+ * the ray is stepped one pixel at a time along its dominant axis and the image is
+ * interpolated linearly along the other axis. Only pixels the ray actually crosses
+ * are visited and no intermediate rotated image is allocated.
+ *
+ * Geometry follows rotate_image(): the row y_c (centered) of the image rotated by
+ * angle_rad is the line (x_c*cos - y_c*sin, x_c*sin + y_c*cos) of the input image.
+ * Pixel centers are placed symmetrically around the image middle, pixel i at
+ * i + 0.5 - width/2, and detector bin d at d + 0.5 - height_sin/2.
+ *
+ * Fan-beam rays go through the same ray_sum(), only their start and direction differ:
+ * the source sits sid behind the image center against the parallel ray direction, and
+ * the detector, centered sdd from the source, has its bins along the same axis the
+ * parallel detector uses, so a very distant source gives the parallel sinogram.
+ */
+
+/* stepping of one ray: the minor coordinate at major index m (m_first <= m <= m_last) is
+   a + slope*m, interpolated between taps n = floor(a + slope*m) and n+1 of the minor axis */
+struct ray_span {
+    int major_stride, minor_stride;     /* in pixels */
+    int minor_len;
+    int m_first, m_last;
+    double a, slope, weight;
+};
+
+/* clip the line (x0,y0) + t*(dir_x,dir_y) to the image, returns 0 if it misses the image */
+static int ray_span(struct ray_span* span, int width, int height, double x0, double y0, double dir_x, double dir_y) {
+    int major_len;
+    double major0, minor0, lo, hi;
+
+    /* step along the axis the ray is closer to */
+    if ( fabs(dir_x) >= fabs(dir_y) ) {
+        major_len = width;        span->major_stride = 1;
+        span->minor_len = height; span->minor_stride = width;
+        major0 = x0; minor0 = y0;
+        span->slope = dir_y / dir_x;
+        span->weight = 1.0 / fabs(dir_x);
+    }
+    else {
+        major_len = height;       span->major_stride = width;
+        span->minor_len = width;  span->minor_stride = 1;
+        major0 = y0; minor0 = x0;
+        span->slope = dir_x / dir_y;
+        span->weight = 1.0 / fabs(dir_y);
+    }
+
+    /* minor coordinate at major index m is a + slope*m, keep m where it lies within (-1, minor_len);
+       both taps are still checked by the callers since the clipped range can be off by rounding */
+    span->a = minor0 - span->slope*major0;
+    span->m_first = 0;
+    span->m_last = major_len - 1;
+    if ( span->slope == 0.0 ) {
+        if ( span->a <= -1.0 || span->a >= span->minor_len ) return 0;
+    }
+    else {
+        lo = (-1.0 - span->a) / span->slope;
+        hi = (span->minor_len - span->a) / span->slope;
+        if ( lo > hi ) { double tmp = lo; lo = hi; hi = tmp; }
+        if ( lo > span->m_last || hi < span->m_first ) return 0;
+        if ( lo > span->m_first ) span->m_first = (int) ceil(lo);
+        if ( hi < span->m_last ) span->m_last = (int) floor(hi);
+    }
+    return 1;
+}
+
+/* sum all channels of input_image along the line (x0,y0) + t*(dir_x,dir_y), given in pixel index
+   coordinates, (dir_x,dir_y) must be a unit vector */
+void ray_sum(float* sum, unsigned char* input_image, int width, int height, int channels, double x0, double y0, double dir_x, double dir_y) {
+    struct ray_span span;
+    int c;
+
+    for ( c = 0; c < channels; c++ ) {
+        sum[c] = 0.0f;
+    }
+    if ( !ray_span(&span, width, height, x0, y0, dir_x, dir_y) ) return;
+
+    long major_stride = (long) span.major_stride*channels;
+    long minor_stride = (long) span.minor_stride*channels;
+
+    for (int m = span.m_first; m <= span.m_last; m++) {
+        double minor = span.a + span.slope*m;
+        int n = (int) floor(minor);
+        float frac = (float) (minor - n);
+        unsigned char* pixel = input_image + m*major_stride + n*minor_stride;
+
+        for ( c = 0; c < channels; c++ ) {
+            float val = 0.0f;
+            if ( n >= 0 && n < span.minor_len ) val += (1.0f - frac) * pixel[c];
+            if ( n + 1 >= 0 && n + 1 < span.minor_len ) val += frac * pixel[minor_stride + c];
+            sum[c] += val;
+        }
+    }
+
+    for ( c = 0; c < channels; c++ ) {
+        sum[c] *= (float) span.weight;
+    }
+}
+
+float ray_sum_float(const float* image, int width, int height, double x0, double y0, double dir_x, double dir_y) {
+    struct ray_span span;
+    float sum = 0.0f;
+
+    if ( !ray_span(&span, width, height, x0, y0, dir_x, dir_y) ) return 0.0f;
+
+    for (int m = span.m_first; m <= span.m_last; m++) {
+        double minor = span.a + span.slope*m;
+        int n = (int) floor(minor);
+        float frac = (float) (minor - n);
+        const float* pixel = image + (long) m*span.major_stride + (long) n*span.minor_stride;
+
+        if ( n >= 0 && n < span.minor_len ) sum += (1.0f - frac) * pixel[0];
+        if ( n + 1 >= 0 && n + 1 < span.minor_len ) sum += frac * pixel[span.minor_stride];
+    }
+    return sum * (float) span.weight;
+}
+
+int ray_taps(unsigned int* pixels, float* weights, int width, int height, double x0, double y0, double dir_x, double dir_y) {
+    struct ray_span span;
+    int count = 0;
+
+    if ( !ray_span(&span, width, height, x0, y0, dir_x, dir_y) ) return 0;
+
+    for (int m = span.m_first; m <= span.m_last; m++) {
+        double minor = span.a + span.slope*m;
+        int n = (int) floor(minor);
+        float frac = (float) (minor - n);
+        unsigned int pixel = (unsigned int) m*span.major_stride + (unsigned int) n*span.minor_stride;
+
+        /* same taps as ray_sum(), the step length folded into the weights */
+        if ( n >= 0 && n < span.minor_len && frac < 1.0f ) {
+            pixels[count] = pixel;
+            weights[count++] = (1.0f - frac) * (float) span.weight;
+        }
+        if ( n + 1 >= 0 && n + 1 < span.minor_len && frac > 0.0f ) {
+            pixels[count] = pixel + span.minor_stride;
+            weights[count++] = frac * (float) span.weight;
+        }
+    }
+    return count;
+}
+
+void detector_ray(double* x0, double* y0, int det, int height_sin, int width, int height, double cos_a, double sin_a) {
+    /* centered offset of this detector bin */
+    double y_c = det + 0.5 - 0.5*height_sin;
+
+    /* point of the ray closest to the image center, moved to pixel index coordinates */
+    *x0 = -y_c*sin_a + 0.5*width - 0.5;
+    *y0 =  y_c*cos_a + 0.5*height - 0.5;
+}
+
+void project_rays(float* projection, int height_sin, unsigned char* input_image, int width, int height, int channels, double angle_rad) {
+    double cos_a = cos(angle_rad);
+    double sin_a = sin(angle_rad);
+    double x0, y0;
+
+    for (int det = 0; det < height_sin; det++) {
+        detector_ray(&x0, &y0, det, height_sin, width, height, cos_a, sin_a);
+
+        /* detector bins of one angle are contiguous, all channels are written in place */
+        ray_sum(projection + det*channels, input_image, width, height, channels, x0, y0, cos_a, sin_a);
+    }
+}
+
+void fan_ray(double* x0, double* y0, double* dir_x, double* dir_y, int det, int height_sin, int width, int height, double cos_a, double sin_a, const struct fan_geometry* fan) {
+    /* offset of the bin from the detector center, along the detector */
+    double u = (det + 0.5 - 0.5*height_sin) * fan->spacing;
+
+    if ( fan->curved ) {
+        /* equiangular: the central ray turned by the bin's fan angle */
+        double gamma = u / fan->sdd;
+        double cos_g = cos(gamma), sin_g = sin(gamma);
+        *dir_x = cos_g*cos_a - sin_g*sin_a;
+        *dir_y = cos_g*sin_a + sin_g*cos_a;
+    }
+    else {
+        /* flat: towards the bin u across the detector plane */
+        double dx = fan->sdd*cos_a - u*sin_a;
+        double dy = fan->sdd*sin_a + u*cos_a;
+        double len = sqrt(dx*dx + dy*dy);
+        *dir_x = dx / len;
+        *dir_y = dy / len;
+    }
+
+    /* every ray starts at the source, moved to pixel index coordinates */
+    *x0 = -fan->sid*cos_a + 0.5*width - 0.5;
+    *y0 = -fan->sid*sin_a + 0.5*height - 0.5;
+}
+
+void project_fan(float* projection, int height_sin, unsigned char* input_image, int width, int height, int channels, double angle_rad, const struct fan_geometry* fan) {
+    double cos_a = cos(angle_rad);
+    double sin_a = sin(angle_rad);
+    double x0, y0, dir_x, dir_y;
+
+    for (int det = 0; det < height_sin; det++) {
+        fan_ray(&x0, &y0, &dir_x, &dir_y, det, height_sin, width, height, cos_a, sin_a, fan);
+        ray_sum(projection + det*channels, input_image, width, height, channels, x0, y0, dir_x, dir_y);
+    }
+}
+
+int fan_detectors(const struct fan_geometry* fan, int width, int height) {
+    double radius = 0.5*sqrt((double) width*width + (double) height*height);
+    double half_angle = asin(radius < fan->sid ? radius / fan->sid : 1.0);
+    double half_width = fan->curved ? fan->sdd*half_angle : fan->sdd*tan(half_angle);
+
+    return 2 * (int) ceil(half_width / fan->spacing);
+}
+
+void project_rays_float(float* projection, int height_sin, const float* image, int width, int height, double angle_rad) {
+    double cos_a = cos(angle_rad);
+    double sin_a = sin(angle_rad);
+    double x0, y0;
+
+    for (int det = 0; det < height_sin; det++) {
+        detector_ray(&x0, &y0, det, height_sin, width, height, cos_a, sin_a);
+        projection[det] = ray_sum_float(image, width, height, x0, y0, cos_a, sin_a);
+    }
+}
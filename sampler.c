@@ -0,0 +1,440 @@
+#include <string.h>
+#include "sinogram.h"
+
+/*
+ * Row samplers.
+ *
+ * rotate_image() samples its output one row at a time, and along a row the source
+ * position moves by a constant step. The vector kernels below compute 8 (AVX2) or
+ * 16 (AVX-512) source positions at once, fetch the source pixels with gather loads
+ * and zero the lanes that fall outside the input image through the gather mask.
+ * Positions are x + i*dx in double and the interpolation repeats the scalar float
+ * arithmetic, so every kernel writes exactly the bytes of the scalar samplers
+ * (--simd scalar compares against them, make check does).
+ * All channels of a pixel are fetched with a single 32-bit gather, so a gather may
+ * read up to 3 bytes past the pixel; groups that would run past the end of the image
+ * buffer are handed to the scalar samplers, as are the remaining pixels of a row.
+ *
+ * The kernel is picked at run time from what the CPU supports.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SAMPLER_X86 1
+#include <immintrin.h>
+#else
+#define SAMPLER_X86 0
+#endif
+
+/* the vector kernels repeat the scalar arithmetic, a contracted multiply-add would round differently */
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+static enum SIMD_LEVEL level_limit = SIMD_AVX512;
+
+/* samples first..last-1 of a row, at x + i*dx like every kernel so all of them agree */
+static void nearest_span(unsigned char* row, unsigned char* input_image, int width, int height, int channels, double x, double y, double dx, double dy, int first, int last) {
+    for (int i = first; i < last; i++) {
+        nearest_neighbour(row + i*channels, input_image, x + i*dx, y + i*dy, width, height, channels);
+    }
+}
+
+static void bilinear_span(unsigned char* row, unsigned char* input_image, int width, int height, int channels, double x, double y, double dx, double dy, int first, int last) {
+    for (int i = first; i < last; i++) {
+        bilinear_interp(row + i*channels, input_image, x + i*dx, y + i*dy, width, height, channels);
+    }
+}
+
+static void nearest_row(unsigned char* row, unsigned char* input_image, int width, int height, int channels, double x, double y, double dx, double dy, int count) {
+    nearest_span(row, input_image, width, height, channels, x, y, dx, dy, 0, count);
+}
+
+static void bilinear_row(unsigned char* row, unsigned char* input_image, int width, int height, int channels, double x, double y, double dx, double dy, int count) {
+    bilinear_span(row, input_image, width, height, channels, x, y, dx, dy, 0, count);
+}
+
+#if SAMPLER_X86
+
+/* write lanes of packed pixels (channel c in byte c) to row */
+static inline void store_pixels(unsigned char* row, const unsigned int* packed, int lanes, int channels) {
+    for (int k = 0; k < lanes; k++) {
+        memcpy(row + k*channels, packed + k, channels);
+    }
+}
+
+/*
+ * Positions along a row are monotonic in each coordinate, rounding included, so a group
+ * of lanes whose end lanes pass the scalar range test lies inside the image entirely.
+ */
+static inline int ends_inside(double x, double y, double dx, double dy, int first, int last, int width, int height) {
+    double x0 = x + first*dx, y0 = y + first*dy;
+    double x1 = x + last*dx, y1 = y + last*dy;
+    return x0 >= 0.0 && y0 >= 0.0 && x0 <= width-1 && y0 <= height-1
+        && x1 >= 0.0 && y1 >= 0.0 && x1 <= width-1 && y1 <= height-1;
+}
+
+/* positions x + i*dx of lanes i = first..first+7, computed as the scalar samplers do */
+__attribute__((target("avx2")))
+static inline void positions_avx2(__m256d* lo, __m256d* hi, double x, double dx, int first) {
+    __m256d index = _mm256_add_pd(_mm256_set1_pd(first), _mm256_setr_pd(0, 1, 2, 3));
+    *lo = _mm256_add_pd(_mm256_set1_pd(x), _mm256_mul_pd(index, _mm256_set1_pd(dx)));
+    *hi = _mm256_add_pd(_mm256_set1_pd(x), _mm256_mul_pd(_mm256_add_pd(index, _mm256_set1_pd(4)), _mm256_set1_pd(dx)));
+}
+
+/* the low 32 bits of the 64-bit lanes of lo and hi, in order */
+__attribute__((target("avx2")))
+static inline __m256i narrow_avx2(__m256i lo, __m256i hi) {
+    const __m256i pick = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    return _mm256_permute2x128_si256(_mm256_permutevar8x32_epi32(lo, pick), _mm256_permutevar8x32_epi32(hi, pick), 0x20);
+}
+
+/* all ones in the lanes whose position passes the scalar samplers' range test */
+__attribute__((target("avx2")))
+static inline __m256i inside_avx2(__m256d x_lo, __m256d x_hi, __m256d y_lo, __m256d y_hi, __m256d x_max, __m256d y_max) {
+    const __m256d zero = _mm256_setzero_pd();
+    __m256d lo = _mm256_and_pd(
+        _mm256_and_pd(_mm256_cmp_pd(x_lo, zero, _CMP_GE_OQ), _mm256_cmp_pd(y_lo, zero, _CMP_GE_OQ)),
+        _mm256_and_pd(_mm256_cmp_pd(x_lo, x_max, _CMP_LE_OQ), _mm256_cmp_pd(y_lo, y_max, _CMP_LE_OQ)));
+    __m256d hi = _mm256_and_pd(
+        _mm256_and_pd(_mm256_cmp_pd(x_hi, zero, _CMP_GE_OQ), _mm256_cmp_pd(y_hi, zero, _CMP_GE_OQ)),
+        _mm256_and_pd(_mm256_cmp_pd(x_hi, x_max, _CMP_LE_OQ), _mm256_cmp_pd(y_hi, y_max, _CMP_LE_OQ)));
+    return narrow_avx2(_mm256_castpd_si256(lo), _mm256_castpd_si256(hi));
+}
+
+/* truncated to int32, lanes out of range give garbage the inside mask removes */
+__attribute__((target("avx2")))
+static inline __m256i truncate_avx2(__m256d lo, __m256d hi) {
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm256_cvttpd_epi32(lo)), _mm256_cvttpd_epi32(hi), 1);
+}
+
+__attribute__((target("avx2")))
+static void nearest_row_avx2(unsigned char* row, unsigned char* input_image, int width, int height, int channels, double x, double y, double dx, double dy, int count) {
+    const long limit = (long) width*height*channels - 4; /* last offset a 32-bit gather may start at */
+    int i = 0;
+
+    if ( limit >= 0 && limit < 0x7fffffff ) {
+        const __m256d half = _mm256_set1_pd(0.5);
+        const __m256d x_max = _mm256_set1_pd(width-1);
+        const __m256d y_max = _mm256_set1_pd(height-1);
+        const __m256i all = _mm256_set1_epi32(-1);
+        const __m256i vwidth = _mm256_set1_epi32(width);
+        const __m256i vchannels = _mm256_set1_epi32(channels);
+        const __m256i vlimit = _mm256_set1_epi32((int) limit);
+        unsigned int packed[8];
+
+        for (; i + 8 <= count; i += 8) {
+            __m256d x_lo, x_hi, y_lo, y_hi;
+            positions_avx2(&x_lo, &x_hi, x, dx, i);
+            positions_avx2(&y_lo, &y_hi, y, dy, i);
+
+            __m256i mask = ends_inside(x, y, dx, dy, i, i + 7, width, height) ? all : inside_avx2(x_lo, x_hi, y_lo, y_hi, x_max, y_max);
+            if ( _mm256_testz_si256(mask, mask) ) {
+                memset(row + i*channels, 0, 8*channels);
+                continue;
+            }
+
+            /* coordinates are not negative inside, so truncation rounds */
+            __m256i ix = _mm256_and_si256(truncate_avx2(_mm256_add_pd(x_lo, half), _mm256_add_pd(x_hi, half)), mask);
+            __m256i iy = _mm256_and_si256(truncate_avx2(_mm256_add_pd(y_lo, half), _mm256_add_pd(y_hi, half)), mask);
+            __m256i offset = _mm256_mullo_epi32(_mm256_add_epi32(_mm256_mullo_epi32(iy, vwidth), ix), vchannels);
+
+            if ( _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(_mm256_cmpgt_epi32(offset, vlimit), mask))) ) {
+                nearest_span(row, input_image, width, height, channels, x, y, dx, dy, i, i + 8);
+                continue;
+            }
+
+            __m256i pixel = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*) input_image, offset, mask, 1);
+            if ( channels == 4 ) {
+                _mm256_storeu_si256((__m256i*) (row + i*4), pixel);
+            }
+            else {
+                _mm256_storeu_si256((__m256i*) packed, pixel);
+                store_pixels(row + i*channels, packed, 8, channels);
+            }
+        }
+    }
+    nearest_span(row, input_image, width, height, channels, x, y, dx, dy, i, count);
+}
+
+__attribute__((target("avx2")))
+static void bilinear_row_avx2(unsigned char* row, unsigned char* input_image, int width, int height, int channels, double x, double y, double dx, double dy, int count) {
+    const long limit = (long) width*height*channels - 4; /* last offset a 32-bit gather may start at */
+    int i = 0;
+
+    if ( limit >= 0 && limit < 0x7fffffff ) {
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256d x_max = _mm256_set1_pd(width-1);
+        const __m256d y_max = _mm256_set1_pd(height-1);
+        const __m256i all = _mm256_set1_epi32(-1);
+        const __m256i one = _mm256_set1_epi32(1);
+        const __m256i last_col = _mm256_set1_epi32(width-1);
+        const __m256i last_row = _mm256_set1_epi32(height-1);
+        const __m256i vwidth = _mm256_set1_epi32(width);
+        const __m256i vchannels = _mm256_set1_epi32(channels);
+        const __m256i vstride = _mm256_set1_epi32(width*channels);
+        const __m256i vlimit = _mm256_set1_epi32((int) limit);
+        const __m256i byte = _mm256_set1_epi32(0xFF);
+        unsigned int packed[8];
+
+        for (; i + 8 <= count; i += 8) {
+            __m256d x_lo, x_hi, y_lo, y_hi;
+            positions_avx2(&x_lo, &x_hi, x, dx, i);
+            positions_avx2(&y_lo, &y_hi, y, dy, i);
+
+            __m256i mask = ends_inside(x, y, dx, dy, i, i + 7, width, height) ? all : inside_avx2(x_lo, x_hi, y_lo, y_hi, x_max, y_max);
+            if ( _mm256_testz_si256(mask, mask) ) {
+                memset(row + i*channels, 0, 8*channels);
+                continue;
+            }
+
+            /* integer parts and fractions of non-negative coordinates, the fractions rounded to float */
+            __m256d fx_lo = _mm256_floor_pd(x_lo), fx_hi = _mm256_floor_pd(x_hi);
+            __m256d fy_lo = _mm256_floor_pd(y_lo), fy_hi = _mm256_floor_pd(y_hi);
+            __m256 wx = _mm256_set_m128(_mm256_cvtpd_ps(_mm256_sub_pd(x_hi, fx_hi)), _mm256_cvtpd_ps(_mm256_sub_pd(x_lo, fx_lo)));
+            __m256 wy = _mm256_set_m128(_mm256_cvtpd_ps(_mm256_sub_pd(y_hi, fy_hi)), _mm256_cvtpd_ps(_mm256_sub_pd(y_lo, fy_lo)));
+
+            /* corners, the right and bottom ones clamped to the image (their weight is 0 there) */
+            __m256i x1 = _mm256_and_si256(truncate_avx2(fx_lo, fx_hi), mask);
+            __m256i y1 = _mm256_and_si256(truncate_avx2(fy_lo, fy_hi), mask);
+            __m256i step_x = _mm256_mullo_epi32(_mm256_sub_epi32(_mm256_min_epi32(_mm256_add_epi32(x1, one), last_col), x1), vchannels);
+            __m256i step_y = _mm256_mullo_epi32(_mm256_sub_epi32(_mm256_min_epi32(_mm256_add_epi32(y1, one), last_row), y1), vstride);
+            __m256i offset1 = _mm256_mullo_epi32(_mm256_add_epi32(_mm256_mullo_epi32(y1, vwidth), x1), vchannels);
+            __m256i offset2 = _mm256_add_epi32(offset1, step_x);
+            __m256i offset3 = _mm256_add_epi32(offset1, step_y);
+            __m256i offset4 = _mm256_add_epi32(offset3, step_x);
+
+            if ( _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(_mm256_cmpgt_epi32(offset4, vlimit), mask))) ) {
+                bilinear_span(row, input_image, width, height, channels, x, y, dx, dy, i, i + 8);
+                continue;
+            }
+
+            __m256i pixel1 = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*) input_image, offset1, mask, 1);
+            __m256i pixel2 = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*) input_image, offset2, mask, 1);
+            __m256i pixel3 = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*) input_image, offset3, mask, 1);
+            __m256i pixel4 = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*) input_image, offset4, mask, 1);
+
+            __m256i result = _mm256_setzero_si256();
+            for (int c = 0; c < channels; c++) {
+                __m128i shift = _mm_cvtsi32_si128(8*c);
+                __m256 val1 = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(pixel1, shift), byte));
+                __m256 val2 = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(pixel2, shift), byte));
+                __m256 val3 = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(pixel3, shift), byte));
+                __m256 val4 = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(pixel4, shift), byte));
+
+                /* the scalar expressions, unfused */
+                __m256 val12 = _mm256_add_ps(val1, _mm256_mul_ps(_mm256_sub_ps(val2, val1), wx));
+                __m256 val34 = _mm256_add_ps(val3, _mm256_mul_ps(_mm256_sub_ps(val4, val3), wx));
+                __m256 val = _mm256_add_ps(_mm256_add_ps(val12, _mm256_mul_ps(_mm256_sub_ps(val34, val12), wy)), half);
+
+                result = _mm256_or_si256(result, _mm256_sll_epi32(_mm256_cvttps_epi32(val), shift));
+            }
+            result = _mm256_and_si256(result, mask);
+
+            if ( channels == 4 ) {
+                _mm256_storeu_si256((__m256i*) (row + i*4), result);
+            }
+            else {
+                _mm256_storeu_si256((__m256i*) packed, result);
+                store_pixels(row + i*channels, packed, 8, channels);
+            }
+        }
+    }
+    bilinear_span(row, input_image, width, height, channels, x, y, dx, dy, i, count);
+}
+
+/* positions x + i*dx of lanes i = first..first+15, computed as the scalar samplers do */
+__attribute__((target("avx512f")))
+static inline void positions_avx512(__m512d* lo, __m512d* hi, double x, double dx, int first) {
+    __m512d index = _mm512_add_pd(_mm512_set1_pd(first), _mm512_setr_pd(0, 1, 2, 3, 4, 5, 6, 7));
+    *lo = _mm512_add_pd(_mm512_set1_pd(x), _mm512_mul_pd(index, _mm512_set1_pd(dx)));
+    *hi = _mm512_add_pd(_mm512_set1_pd(x), _mm512_mul_pd(_mm512_add_pd(index, _mm512_set1_pd(8)), _mm512_set1_pd(dx)));
+}
+
+/* lanes whose position passes the scalar samplers' range test */
+__attribute__((target("avx512f")))
+static inline __mmask8 inside_avx512(__m512d x, __m512d y, __m512d x_max, __m512d y_max) {
+    const __m512d zero = _mm512_setzero_pd();
+    return _mm512_cmp_pd_mask(x, zero, _CMP_GE_OQ) & _mm512_cmp_pd_mask(y, zero, _CMP_GE_OQ)
+         & _mm512_cmp_pd_mask(x, x_max, _CMP_LE_OQ) & _mm512_cmp_pd_mask(y, y_max, _CMP_LE_OQ);
+}
+
+/* truncated to int32, zero outside the mask */
+__attribute__((target("avx512f")))
+static inline __m512i truncate_avx512(__mmask16 inside, __m512d lo, __m512d hi) {
+    return _mm512_inserti64x4(_mm512_castsi256_si512(_mm512_maskz_cvttpd_epi32((__mmask8) inside, lo)),
+                              _mm512_maskz_cvttpd_epi32((__mmask8) (inside >> 8), hi), 1);
+}
+
+__attribute__((target("avx512f")))
+static void nearest_row_avx512(unsigned char* row, unsigned char* input_image, int width, int height, int channels, double x, double y, double dx, double dy, int count) {
+    const long limit = (long) width*height*channels - 4; /* last offset a 32-bit gather may start at */
+    int i = 0;
+
+    if ( limit >= 0 && limit < 0x7fffffff ) {
+        const __m512d half = _mm512_set1_pd(0.5);
+        const __m512d x_max = _mm512_set1_pd(width-1);
+        const __m512d y_max = _mm512_set1_pd(height-1);
+        const __m512i vwidth = _mm512_set1_epi32(width);
+        const __m512i vchannels = _mm512_set1_epi32(channels);
+        const __m512i vlimit = _mm512_set1_epi32((int) limit);
+        unsigned int packed[16];
+
+        for (; i + 16 <= count; i += 16) {
+            __m512d x_lo, x_hi, y_lo, y_hi;
+            positions_avx512(&x_lo, &x_hi, x, dx, i);
+            positions_avx512(&y_lo, &y_hi, y, dy, i);
+
+            __mmask16 inside = ends_inside(x, y, dx, dy, i, i + 15, width, height) ? 0xFFFF
+                             : inside_avx512(x_lo, y_lo, x_max, y_max) | (__mmask16) inside_avx512(x_hi, y_hi, x_max, y_max) << 8;
+            if ( inside == 0 ) {
+                memset(row + i*channels, 0, 16*channels);
+                continue;
+            }
+
+            /* coordinates are not negative inside, so truncation rounds */
+            __m512i ix = truncate_avx512(inside, _mm512_add_pd(x_lo, half), _mm512_add_pd(x_hi, half));
+            __m512i iy = truncate_avx512(inside, _mm512_add_pd(y_lo, half), _mm512_add_pd(y_hi, half));
+            __m512i offset = _mm512_mullo_epi32(_mm512_add_epi32(_mm512_mullo_epi32(iy, vwidth), ix), vchannels);
+
+            if ( _mm512_mask_cmpgt_epi32_mask(inside, offset, vlimit) ) {
+                nearest_span(row, input_image, width, height, channels, x, y, dx, dy, i, i + 16);
+                continue;
+            }
+
+            __m512i pixel = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), inside, offset, input_image, 1);
+            if ( channels == 4 ) {
+                _mm512_storeu_si512(row + i*4, pixel);
+            }
+            else if ( channels == 1 ) {
+                _mm_storeu_si128((__m128i*) (row + i), _mm512_cvtepi32_epi8(pixel));
+            }
+            else {
+                _mm512_storeu_si512(packed, pixel);
+                store_pixels(row + i*channels, packed, 16, channels);
+            }
+        }
+    }
+    nearest_span(row, input_image, width, height, channels, x, y, dx, dy, i, count);
+}
+
+__attribute__((target("avx512f")))
+static void bilinear_row_avx512(unsigned char* row, unsigned char* input_image, int width, int height, int channels, double x, double y, double dx, double dy, int count) {
+    const long limit = (long) width*height*channels - 4; /* last offset a 32-bit gather may start at */
+    int i = 0;
+
+    if ( limit >= 0 && limit < 0x7fffffff ) {
+        const __m512 half = _mm512_set1_ps(0.5f);
+        const __m512d x_max = _mm512_set1_pd(width-1);
+        const __m512d y_max = _mm512_set1_pd(height-1);
+        const __m512i one = _mm512_set1_epi32(1);
+        const __m512i last_col = _mm512_set1_epi32(width-1);
+        const __m512i last_row = _mm512_set1_epi32(height-1);
+        const __m512i vwidth = _mm512_set1_epi32(width);
+        const __m512i vchannels = _mm512_set1_epi32(channels);
+        const __m512i vstride = _mm512_set1_epi32(width*channels);
+        const __m512i vlimit = _mm512_set1_epi32((int) limit);
+        const __m512i byte = _mm512_set1_epi32(0xFF);
+        unsigned int packed[16];
+
+        for (; i + 16 <= count; i += 16) {
+            __m512d x_lo, x_hi, y_lo, y_hi;
+            positions_avx512(&x_lo, &x_hi, x, dx, i);
+            positions_avx512(&y_lo, &y_hi, y, dy, i);
+
+            __mmask16 inside = ends_inside(x, y, dx, dy, i, i + 15, width, height) ? 0xFFFF
+                             : inside_avx512(x_lo, y_lo, x_max, y_max) | (__mmask16) inside_avx512(x_hi, y_hi, x_max, y_max) << 8;
+            if ( inside == 0 ) {
+                memset(row + i*channels, 0, 16*channels);
+                continue;
+            }
+
+            /* integer parts and fractions of non-negative coordinates, the fractions rounded to float */
+            __m512d fx_lo = _mm512_roundscale_pd(x_lo, _MM_FROUND_TO_NEG_INF), fx_hi = _mm512_roundscale_pd(x_hi, _MM_FROUND_TO_NEG_INF);
+            __m512d fy_lo = _mm512_roundscale_pd(y_lo, _MM_FROUND_TO_NEG_INF), fy_hi = _mm512_roundscale_pd(y_hi, _MM_FROUND_TO_NEG_INF);
+            __m512 wx = _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castpd256_pd512(_mm256_castps_pd(_mm512_cvtpd_ps(_mm512_sub_pd(x_lo, fx_lo)))),
+                                                            _mm256_castps_pd(_mm512_cvtpd_ps(_mm512_sub_pd(x_hi, fx_hi))), 1));
+            __m512 wy = _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castpd256_pd512(_mm256_castps_pd(_mm512_cvtpd_ps(_mm512_sub_pd(y_lo, fy_lo)))),
+                                                            _mm256_castps_pd(_mm512_cvtpd_ps(_mm512_sub_pd(y_hi, fy_hi))), 1));
+
+            /* corners, the right and bottom ones clamped to the image (their weight is 0 there) */
+            __m512i x1 = truncate_avx512(inside, fx_lo, fx_hi);
+            __m512i y1 = truncate_avx512(inside, fy_lo, fy_hi);
+            __m512i step_x = _mm512_mullo_epi32(_mm512_sub_epi32(_mm512_min_epi32(_mm512_add_epi32(x1, one), last_col), x1), vchannels);
+            __m512i step_y = _mm512_mullo_epi32(_mm512_sub_epi32(_mm512_min_epi32(_mm512_add_epi32(y1, one), last_row), y1), vstride);
+            __m512i offset1 = _mm512_mullo_epi32(_mm512_add_epi32(_mm512_mullo_epi32(y1, vwidth), x1), vchannels);
+            __m512i offset2 = _mm512_add_epi32(offset1, step_x);
+            __m512i offset3 = _mm512_add_epi32(offset1, step_y);
+            __m512i offset4 = _mm512_add_epi32(offset3, step_x);
+
+            if ( _mm512_mask_cmpgt_epi32_mask(inside, offset4, vlimit) ) {
+                bilinear_span(row, input_image, width, height, channels, x, y, dx, dy, i, i + 16);
+                continue;
+            }
+
+            __m512i pixel1 = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), inside, offset1, input_image, 1);
+            __m512i pixel2 = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), inside, offset2, input_image, 1);
+            __m512i pixel3 = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), inside, offset3, input_image, 1);
+            __m512i pixel4 = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), inside, offset4, input_image, 1);
+
+            __m512i result = _mm512_setzero_si512();
+            for (int c = 0; c < channels; c++) {
+                __m128i shift = _mm_cvtsi32_si128(8*c);
+                __m512 val1 = _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srl_epi32(pixel1, shift), byte));
+                __m512 val2 = _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srl_epi32(pixel2, shift), byte));
+                __m512 val3 = _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srl_epi32(pixel3, shift), byte));
+                __m512 val4 = _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srl_epi32(pixel4, shift), byte));
+
+                /* the scalar expressions, unfused */
+                __m512 val12 = _mm512_add_ps(val1, _mm512_mul_ps(_mm512_sub_ps(val2, val1), wx));
+                __m512 val34 = _mm512_add_ps(val3, _mm512_mul_ps(_mm512_sub_ps(val4, val3), wx));
+                __m512 val = _mm512_add_ps(_mm512_add_ps(val12, _mm512_mul_ps(_mm512_sub_ps(val34, val12), wy)), half);
+
+                result = _mm512_or_si512(result, _mm512_sll_epi32(_mm512_cvttps_epi32(val), shift));
+            }
+            result = _mm512_maskz_mov_epi32(inside, result);
+
+            if ( channels == 4 ) {
+                _mm512_storeu_si512(row + i*4, result);
+            }
+            else if ( channels == 1 ) {
+                _mm_storeu_si128((__m128i*) (row + i), _mm512_cvtepi32_epi8(result));
+            }
+            else {
+                _mm512_storeu_si512(packed, result);
+                store_pixels(row + i*channels, packed, 16, channels);
+            }
+        }
+    }
+    bilinear_span(row, input_image, width, height, channels, x, y, dx, dy, i, count);
+}
+
+#endif
+
+enum SIMD_LEVEL simd_level(void) {
+    enum SIMD_LEVEL level = SIMD_SCALAR;
+#if SAMPLER_X86
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx512f") ) level = SIMD_AVX512;
+    else if ( __builtin_cpu_supports("avx2") ) level = SIMD_AVX2;
+#endif
+    return level < level_limit ? level : level_limit;
+}
+
+void limit_simd_level(enum SIMD_LEVEL level) {
+    level_limit = level;
+}
+
+sample_row_fn select_sampler(enum INTERPOLATION interp) {
+    switch ( simd_level() ) {
+#if SAMPLER_X86
+    case SIMD_AVX512:
+        return interp == BILINEAR ? bilinear_row_avx512 : nearest_row_avx512;
+    case SIMD_AVX2:
+        return interp == BILINEAR ? bilinear_row_avx2 : nearest_row_avx2;
+#endif
+    default:
+        return interp == BILINEAR ? bilinear_row : nearest_row;
+    }
+}
@@ -0,0 +1,288 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sinogram.h"
+
+/*
+ * Three-shear rotation.
+ *
+ * A rotation by phi is the product of three shears (Paeth),
+ *
+ *     R(phi) = Sx(a) Sy(b) Sx(a),   a = -tan(phi/2),  b = sin(phi),
+ *
+ * with Sx(a) moving (x,y) to (x + a*y, y) and Sy(b) moving it to (x, y + b*x). Each
+ * horizontal shear shifts every row by a constant amount, so one row of output is a 1D
+ * resampling of one row of input with the same filter weights all along it: a few
+ * multiply-adds over contiguous floats that the compiler vectorizes. The vertical shear
+ * is a horizontal one on the transposed image: a strip of rows is sheared while it is
+ * in cache and written out transposed, so the whole rotation is three streaming passes
+ * and no pass walks an image plane down its columns. Shears are only accurate for
+ * |phi| <= 45 degrees, larger angles first take the nearest quarter turn, an exact
+ * reindexing done while the first pass reads the input into float rows.
+ *
+ * The result is the image rotate_image() would give: pixel (col,row) of the rotated
+ * grid holds the input at rotate_position(col,row), interpolated by three 1D filters
+ * instead of one 2D sampler, and rounded to 8 bit only once at the end.
+ */
+
+/* rows sheared together and then transposed, while they are still in cache */
+#define SHEAR_STRIP 32
+
+/* floats of a row multiplied by the same filter tap at a time; a whole block has a
+   fixed trip count and vectorizes */
+#define SHIFT_BLOCK 64
+
+/* taps of the 1D filters: linear, and a Lanczos windowed sinc of 3 lobes */
+#define LINEAR_TAPS 2
+#define SINC_TAPS 6
+#define SINC_LOBES 3
+
+/* extent of an interleaved float image, pixel (i,j) at centered position (x0 + i, y0 + j) */
+struct plane {
+    int width, height;
+    double x0, y0;
+};
+
+static double lanczos(double x) {
+    if ( fabs(x) < 1e-12 ) return 1.0;
+    if ( fabs(x) >= SINC_LOBES ) return 0.0;
+    return SINC_LOBES*sin(M_PI*x)*sin(M_PI*x / SINC_LOBES) / (M_PI*M_PI*x*x);
+}
+
+/* weights of the taps at floor(position) - taps/2 + 1 onwards, frac = position - floor(position) */
+static void filter_weights(float* weights, double frac, int taps) {
+    double w[SINC_TAPS], sum = 0.0;
+
+    if ( taps == LINEAR_TAPS ) {
+        weights[0] = (float) (1.0 - frac);
+        weights[1] = (float) frac;
+        return;
+    }
+    for (int t = 0; t < taps; t++) {
+        w[t] = lanczos(t - (taps/2 - 1) - frac);
+        sum += w[t];
+    }
+    for (int t = 0; t < taps; t++) {
+        weights[t] = (float) (w[t] / sum);
+    }
+}
+
+/* out[i] = in interpolated at i + position for i < count, zero beyond the ends of in */
+static void shift_row(float* out, int count, const float* in, int length, int channels, double position, int taps) {
+    float weights[SINC_TAPS];
+    double base = floor(position);
+    int first, lo, hi, touch_lo, touch_hi;
+
+    /* the taps of out[i] start at input pixel i + first */
+    filter_weights(weights, position - base, taps);
+    first = (int) base - (taps/2 - 1);
+
+    /* out[lo..hi] have all their taps inside in, those outside [touch_lo, touch_hi] none */
+    lo = first < 0 ? -first : 0;
+    hi = length - taps - first;
+    touch_lo = -first - taps + 1 > 0 ? -first - taps + 1 : 0;
+    touch_hi = length - 1 - first < count - 1 ? length - 1 - first : count - 1;
+    if ( touch_lo > count ) touch_lo = count;
+    if ( lo < touch_lo ) lo = touch_lo;
+    if ( lo > count ) lo = count;
+    if ( hi > count - 1 ) hi = count - 1;
+    if ( hi < lo - 1 ) hi = lo - 1;
+    if ( touch_hi < touch_lo - 1 ) touch_hi = touch_lo - 1;
+
+    memset(out, 0, (size_t) touch_lo*channels*sizeof(float));
+    if ( touch_hi < count - 1 ) memset(out + (long) (touch_hi + 1)*channels, 0, (size_t) (count-1 - touch_hi)*channels*sizeof(float));
+
+    /* the few pixels with only some taps inside */
+    for (int i = touch_lo; i <= touch_hi; i++) {
+        if ( i == lo ) i = hi + 1;
+        if ( i > touch_hi ) break;
+        for (int c = 0; c < channels; c++) {
+            float sum = 0.0f;
+            for (int t = 0; t < taps; t++) {
+                int p = i + first + t;
+                if ( p >= 0 && p < length ) sum += weights[t]*in[(long) p*channels + c];
+            }
+            out[(long) i*channels + c] = sum;
+        }
+    }
+
+    long n = (long) (hi - lo + 1)*channels;
+    for (long k0 = 0; k0 < n; k0 += SHIFT_BLOCK) {
+        float* o = out + (long) lo*channels + k0;
+        const float* s = in + (long) (lo + first)*channels + k0;
+        int m = n - k0 < SHIFT_BLOCK ? (int) (n - k0) : SHIFT_BLOCK;
+        float block[SHIFT_BLOCK];
+
+        if ( m == SHIFT_BLOCK ) {
+            for (int k = 0; k < SHIFT_BLOCK; k++) block[k] = weights[0]*s[k];
+            for (int t = 1; t < taps; t++) {
+                const float* st = s + (long) t*channels;
+                for (int k = 0; k < SHIFT_BLOCK; k++) block[k] += weights[t]*st[k];
+            }
+            memcpy(o, block, sizeof(block));
+            continue;
+        }
+        for (int k = 0; k < m; k++) {
+            float sum = 0.0f;
+            for (int t = 0; t < taps; t++) sum += weights[t]*s[k + (long) t*channels];
+            o[k] = sum;
+        }
+    }
+}
+
+/* the input turned by turns*90 degrees, so the remaining rotation is within 45 degrees */
+static void turned_plane(struct plane* turned, int width, int height, int turns) {
+    /* pixel (x,y) of the input at centered (x - width/2, y - height/2) lands on the inverse turn of that */
+    turned->width = turns & 1 ? height : width;
+    turned->height = turns & 1 ? width : height;
+    turned->x0 = turns == 0 ? -0.5*width : turns == 1 ? -0.5*height : turns == 2 ? 1.0 - 0.5*width : 1.0 - 0.5*height;
+    turned->y0 = turns == 0 ? -0.5*height : turns == 1 ? 1.0 - 0.5*width : turns == 2 ? 1.0 - 0.5*height : -0.5*width;
+}
+
+/* rows [j0, j0+rows) of the turned input as float; odd turns read a few bytes of every input row */
+static void load_turned_rows(float* out, const unsigned char* input_image, int width, int height, int channels, int turns, int j0, int rows) {
+    int length = turns & 1 ? height : width;
+
+    if ( turns & 1 ) {
+        /* turned pixel (i,j) is input (width-1 - j, i) for one turn, (j, height-1 - i) for three */
+        for (int y = 0; y < height; y++) {
+            const unsigned char* in = input_image + (long) y*width*channels;
+            int i = turns == 1 ? y : height-1 - y;
+            if ( channels == 1 ) {
+                /* rows r are consecutive input bytes, backwards for one turn */
+                int step = turns == 1 ? -1 : 1;
+                in += turns == 1 ? width-1 - j0 : j0;
+                for (int r = 0; r < rows; r++) out[(long) r*length + i] = in[r*step];
+                continue;
+            }
+            for (int r = 0; r < rows; r++) {
+                int x = turns == 1 ? width-1 - (j0 + r) : j0 + r;
+                float* o = out + ((long) r*length + i)*channels;
+                for (int c = 0; c < channels; c++) o[c] = in[x*channels + c];
+            }
+        }
+        return;
+    }
+
+    /* turned row j is input row j, or row height-1 - j reversed for two turns */
+    for (int r = 0; r < rows; r++) {
+        int y = turns == 0 ? j0 + r : height-1 - (j0 + r);
+        const unsigned char* in = input_image + (long) y*width*channels;
+        float* o = out + (long) r*length*channels;
+        if ( turns == 0 ) {
+            for (int k = 0; k < width*channels; k++) o[k] = in[k];
+            continue;
+        }
+        for (int i = 0; i < width; i++) {
+            for (int c = 0; c < channels; c++) o[i*channels + c] = in[(width-1 - i)*channels + c];
+        }
+    }
+}
+
+/* rows x cols strip into columns [j0, j0+rows) of the plane of row length stride */
+static void store_transposed(float* plane, int stride, int j0, const float* strip, int rows, int cols, int channels) {
+    if ( channels == 1 && rows == SHEAR_STRIP ) {
+        for (int i = 0; i < cols; i++) {
+            float* o = plane + (long) i*stride + j0;
+            for (int r = 0; r < SHEAR_STRIP; r++) o[r] = strip[(long) r*cols + i];
+        }
+        return;
+    }
+    for (int i = 0; i < cols; i++) {
+        float* o = plane + ((long) i*stride + j0)*channels;
+        for (int r = 0; r < rows; r++) {
+            for (int c = 0; c < channels; c++) o[r*channels + c] = strip[((long) r*cols + i)*channels + c];
+        }
+    }
+}
+
+/* floats of one plane, enough for every pass of any angle */
+static size_t plane_floats(int width, int height, int channels) {
+    int side = width > height ? width : height;
+    size_t diagonal = (size_t) ceil(sqrt((double) width*width + (double) height*height)) + 2;
+    /* rows widen by at most tan(22.5 degrees) of the height in the first shear */
+    size_t columns = (size_t) ceil(side*(1.0 + tan(M_PI / 8.0))) + 2*SINC_TAPS + 2;
+    size_t floats = columns*diagonal*channels;
+    return (floats + 15) / 16 * 16;
+}
+
+/* floats of one strip, rows as long as the longest row of any pass */
+static size_t strip_floats(int width, int height, int channels) {
+    int side = width > height ? width : height;
+    size_t diagonal = (size_t) ceil(sqrt((double) width*width + (double) height*height)) + 2;
+    size_t columns = (size_t) ceil(side*(1.0 + tan(M_PI / 8.0))) + 2*SINC_TAPS + 2;
+    size_t floats = SHEAR_STRIP*(columns > diagonal ? columns : diagonal)*channels;
+    return (floats + 15) / 16 * 16;
+}
+
+size_t shear_scratch_bound(int width, int height, int channels) {
+    return (2*plane_floats(width, height, channels) + 2*strip_floats(width, height, channels))*sizeof(float);
+}
+
+void rotate_image_shear(unsigned char* rotated_image, unsigned char* input_image, double angle, int width, int height, int width_rot, int height_rot, int channels, enum ROTATION rotation, float* scratch) {
+    int taps = rotation == ROTATION_SHEAR_SINC ? SINC_TAPS : LINEAR_TAPS;
+    double turns = floor(angle / (0.5*M_PI) + 0.5);
+    double phi = angle - turns*0.5*M_PI;
+    double a = -tan(0.5*phi), b = sin(phi);
+    double x0_rot = -0.5*width_rot, y0_rot = -0.5*height_rot;
+    double shift_min, shift_max;
+    struct plane turned, sheared, rotated;
+
+    /* the first and second shear, both kept transposed, and two strips of rows in and out */
+    float* first = scratch;
+    float* second = first + plane_floats(width, height, channels);
+    float* strip_in = second + plane_floats(width, height, channels);
+    float* strip_out = strip_in + strip_floats(width, height, channels);
+
+    /* input(R(angle) q) = turned(R(phi) q) */
+    turned_plane(&turned, width, height, (int) fmod(fmod(turns, 4.0) + 4.0, 4.0));
+
+    /* first shear, x + a*y: as wide as the shifted rows reach */
+    shift_min = fmin(a*turned.y0, a*(turned.y0 + turned.height - 1));
+    shift_max = fmax(a*turned.y0, a*(turned.y0 + turned.height - 1));
+    sheared.x0 = turned.x0 - taps/2 - shift_max;
+    sheared.y0 = turned.y0;
+    sheared.width = (int) ceil(turned.x0 + turned.width - 1 + taps/2 - shift_min - sheared.x0) + 1;
+    sheared.height = turned.height;
+    for (int j0 = 0; j0 < turned.height; j0 += SHEAR_STRIP) {
+        int rows = turned.height - j0 < SHEAR_STRIP ? turned.height - j0 : SHEAR_STRIP;
+
+        load_turned_rows(strip_in, input_image, width, height, channels, (int) fmod(fmod(turns, 4.0) + 4.0, 4.0), j0, rows);
+        for (int r = 0; r < rows; r++) {
+            double position = sheared.x0 + a*(sheared.y0 + j0 + r) - turned.x0;
+            shift_row(strip_out + (long) r*sheared.width*channels, sheared.width, strip_in + (long) r*turned.width*channels,
+                      turned.width, channels, position, taps);
+        }
+        store_transposed(first, sheared.height, j0, strip_out, rows, sheared.width, channels);
+    }
+
+    /* second shear, y + b*x, along the columns of the first, only onto the rows of the rotated grid */
+    rotated.x0 = sheared.x0;
+    rotated.y0 = y0_rot;
+    rotated.width = sheared.width;
+    rotated.height = height_rot;
+    for (int i0 = 0; i0 < sheared.width; i0 += SHEAR_STRIP) {
+        int rows = sheared.width - i0 < SHEAR_STRIP ? sheared.width - i0 : SHEAR_STRIP;
+
+        for (int r = 0; r < rows; r++) {
+            double position = rotated.y0 + b*(sheared.x0 + i0 + r) - sheared.y0;
+            shift_row(strip_out + (long) r*rotated.height*channels, rotated.height, first + (long) (i0 + r)*sheared.height*channels,
+                      sheared.height, channels, position, taps);
+        }
+        store_transposed(second, rotated.width, i0, strip_out, rows, rotated.height, channels);
+    }
+
+    /* third shear, x + a*y again, straight onto the rotated grid */
+    for (int row = 0; row < height_rot; row++) {
+        unsigned char* pixel = rotated_image + (long) row*width_rot*channels;
+        double position = x0_rot + a*(y0_rot + row) - rotated.x0;
+
+        shift_row(strip_in, width_rot, second + (long) row*rotated.width*channels, rotated.width, channels, position, taps);
+        for (int k = 0; k < width_rot*channels; k++) {
+            float v = strip_in[k] + 0.5f;
+            v = v < 0.0f ? 0.0f : v;
+            v = v > 255.0f ? 255.0f : v;
+            pixel[k] = (unsigned char) (int) v;
+        }
+    }
+}
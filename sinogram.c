@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sinogram.h"
+
+void draw_channel(unsigned char* input_image, int width, int height, int channels, enum CHANNELS offset) {
+    int N = width*height;
+    int pixel_num = 0;
+    int val = 0;
+
+    for (; pixel_num < N; pixel_num++) {
+            val = *(input_image + channels*pixel_num + offset);
+            
+            if ( pixel_num % width == 0) {
+                printf("\n");
+            }
+            if ( val < 10 ) printf("%d   ", val);
+            else if ( val < 100 ) printf("%d  ", val);
+            else printf("%d ", val);
+        }
+}
+
+void size_of_rotated_image(int* width_rot, int* height_rot, int height, int width, double angle) {
+    double x[4], y[4];
+    double x_rot[4], y_rot[4];
+
+    /* define 4 corners */
+    x[0] = -0.5*(double)width;
+    x[1] = -x[0];
+    x[2] = x[1];
+    x[3] = x[0];
+
+    y[0] = 0.5*(double)height;
+    y[1] = y[0];
+    y[2] = -y[1];
+    y[3] = y[2];
+
+    /* find rotated positions */
+    x_rot[0] = x[0] * cos(angle) - y[0] * sin(angle);
+    y_rot[0] = x[0] * sin(angle) + y[0] * cos(angle);
+
+    x_rot[1] = x[1] * cos(angle) - y[1] * sin(angle);
+    y_rot[1] = x[1] * sin(angle) + y[1] * cos(angle);
+
+    x_rot[2] = x[2] * cos(angle) - y[2] * sin(angle);
+    y_rot[2] = x[2] * sin(angle) + y[2] * cos(angle);
+
+    x_rot[3] = x[3] * cos(angle) - y[3] * sin(angle);
+    y_rot[3] = x[3] * sin(angle) + y[3] * cos(angle);
+
+    /* get maximum width and height */
+    *(width_rot) = (int) 2 * round( fmax( fmax(abs(x_rot[0]), abs(x_rot[1])), fmax(abs(x_rot[2]), abs(x_rot[3])) ) );
+    *(height_rot) = (int) 2 * round( fmax( fmax(abs(y_rot[0]), abs(y_rot[1])), fmax(abs(y_rot[2]), abs(y_rot[3])) ) );
+}
+
+/* narrow [*first, *last] to the steps i where p + i*dp lies within [0, limit], with some slack
+   for rounding and one extra step on each side (the samplers check bounds anyway) */
+static void clip_span(double p, double dp, double limit, int* first, int* last) {
+    double lo, hi, tmp;
+
+    if ( dp == 0.0 ) {
+        if ( p < -1e-6 || p > limit + 1e-6 ) *last = *first - 1;
+        return;
+    }
+    lo = (-1e-6 - p) / dp;
+    hi = (limit + 1e-6 - p) / dp;
+    if ( lo > hi ) { tmp = lo; lo = hi; hi = tmp; }
+
+    if ( hi < *first || lo > *last ) {
+        *last = *first - 1;
+        return;
+    }
+    if ( lo - 1.0 > *first ) *first = (int) lo - 1;
+    if ( hi + 1.0 < *last ) *last = (int) hi + 1;
+}
+
+void rotate_image(unsigned char* rotated_image, unsigned char* input_image, double angle, int width, int height, int width_rot, int height_rot, int channels, enum INTERPOLATION interp) {
+    double x,y;
+
+    /* trigonometry is needed only once per angle */
+    double cos_a = cos(angle);
+    double sin_a = sin(angle);
+
+    /* widest vector kernel this CPU supports */
+    sample_row_fn sample_row = select_sampler(interp);
+
+    for (int row = 0; row < height_rot; row++) {
+        unsigned char* pixel = rotated_image + (long) row*width_rot*channels;
+        int first = 0, last = width_rot - 1;
+
+        // 1. find rotated position of the first pixel in the row
+        rotate_position(&x, &y, 0, row, cos_a, sin_a, width_rot, height_rot, width, height);
+
+        // 2. only the part of the row that falls on the input image needs sampling, the rest is cleared
+        clip_span(x, cos_a, width - 1, &first, &last);
+        clip_span(y, sin_a, height - 1, &first, &last);
+        if ( first > last ) {
+            memset(pixel, 0, (size_t) width_rot*channels);
+            continue;
+        }
+        memset(pixel, 0, (size_t) first*channels);
+        memset(pixel + (long) (last+1)*channels, 0, (size_t) (width_rot-1 - last)*channels);
+
+        // 3. sample the span, every next pixel moves by a constant step (cos, sin) in the input image
+        sample_row(pixel + (long) first*channels, input_image, width, height, channels, x + first*cos_a, y + first*sin_a, cos_a, sin_a, last - first + 1);
+    }
+}
+
+void rotate_position(double* x, double* y, int col, int row, double cos_a, double sin_a, int width_rot, int height_rot, int width, int height) {
+    double x_rot, y_rot;
+    
+    /* compute pixel position*/
+    *x = col;
+    *y = row;
+
+    /* center around middle of image */
+    *x = *x - 0.5*width_rot;
+    *y = *y - 0.5*height_rot;
+
+    /* compute pixel position after rotation */
+    x_rot = (*x) * cos_a - (*y) * sin_a;
+    y_rot = (*x) * sin_a + (*y) * cos_a;
+    
+    /* move origin back to (0,0) in coords of input image*/
+    x_rot = x_rot + 0.5*width;
+    y_rot = y_rot + 0.5*height;
+
+    *x = x_rot;
+    *y = y_rot;
+}
+
+void fill_sinogram(float* projection, int height_sin, unsigned char* rotated_image, int width_rot, int height_rot, int channels) {
+    unsigned char* pixel;
+    unsigned int sum;
+    int projection_offset = 0;
+
+    /* compute shift of the projection center relative to sinogram center (in height direction) */
+    projection_offset = (height_sin - height_rot) / 2;
+
+    /* for every row ... */
+    for (int row = 0; row < height_rot; row++) {
+        /* rows falling outside a narrower detector are lost */
+        if ( row + projection_offset < 0 || row + projection_offset >= height_sin ) continue;
+
+        /* ... and every channel, project current row of rotated image, the row stays in L1 between channels ... */
+        pixel = rotated_image + (long) row*width_rot*channels;
+        for ( int c = 0; c < channels; c++ ) {
+            /* integer sums of 8-bit samples are exact, unlike a float accumulator they vectorize */
+            sum = 0;
+            for (int col = 0; col < width_rot; col++) {
+                sum += pixel[col*channels + c];
+            }
+
+            /* ... and store it in the contiguous projection of this angle, the full sum is kept,
+               scaling to an output range is left to write_sinogram() */
+            projection[(row + projection_offset)*channels + c] = (float) sum;
+        }
+    }
+}
+
+void nearest_neighbour(unsigned char* pixel, unsigned char* input_image, double x, double y, int width, int height, int channels) {
+    int pixel_num;
+    int c;
+
+    /* outside image case */
+    if ( x < 0.0 || y < 0.0 || x > (width-1) || y > (height-1) ) {
+        for ( c = 0; c < channels; c++ ) pixel[c] = 0;
+        return;
+    }
+
+    /* x,y are not negative here, so truncation rounds like round() */
+    pixel_num = (int) (x + 0.5) + (int) (y + 0.5)*width;
+    for ( c = 0; c < channels; c++ ) {
+        pixel[c] = *(input_image + channels*pixel_num + c);
+    }
+}
+
+void bilinear_interp(unsigned char* pixel, unsigned char* input_image, double x, double y, int width, int height, int channels) {
+    int pixel_num1, pixel_num2, pixel_num3, pixel_num4;
+    int x1, y1, x2, y2;
+    float dx, dy;
+    float val1, val2, val3, val4;
+    float val12, val34;
+    int c;
+
+    /* outside image case */
+    if ( x < 0.0 || y < 0.0 || x > (width-1) || y > (height-1) ) {
+        for ( c = 0; c < channels; c++ ) pixel[c] = 0;
+        return;
+    }
+
+    /* floor and ceil of non-negative coordinates */
+    x1 = (int) x;
+    y1 = (int) y;
+    dx = (float) (x - x1);
+    dy = (float) (y - y1);
+    x2 = x1 + (dx > 0.0f);
+    y2 = y1 + (dy > 0.0f);
+
+    /* left top, right top, left bottom and right bottom corner */
+    pixel_num1 = x1 + y1*width;
+    pixel_num2 = x2 + y1*width;
+    pixel_num3 = x1 + y2*width;
+    pixel_num4 = x2 + y2*width;
+
+    for ( c = 0; c < channels; c++ ) {
+        val1 = (float) *(input_image + channels*pixel_num1 + c);
+        val2 = (float) *(input_image + channels*pixel_num2 + c);
+        val3 = (float) *(input_image + channels*pixel_num3 + c);
+        val4 = (float) *(input_image + channels*pixel_num4 + c);
+
+        /* for pixel grid the denominator (x2-x1) = 1 */
+        val12 = val1 + (val2-val1)*dx;
+        val34 = val3 + (val4-val3)*dx;
+
+        pixel[c] = (unsigned char) ( val12 + (val34-val12)*dy + 0.5f );
+    }
+}
+
+/* bytes of an image row whose column sums are accumulated together */
+#define COLUMN_BLOCK 256
+
+/*
+ * At multiples of 90 degrees every row of the rotated grid lies on one row (0 and 180
+ * degrees) or one column (90 and 270) of the input image, and samples it at whole pixel
+ * steps, so rotating is just reindexing. The grid is mapped with rotate_position() and
+ * exact cos and sin, the samples rounded as nearest_neighbour() does, and each projection
+ * bin becomes the sum of a run of one input row, or one entry of column sums accumulated
+ * over a run of input rows. For even image sizes the positions are whole pixels and the
+ * bilinear sampler reads the same pixels.
+ */
+void project_quarter_turn(float* projection, int height_sin, unsigned char* input_image, int width, int height, int channels, int turns, unsigned int* sums) {
+    static const int cos_turn[4] = { 1, 0, -1, 0 };
+    static const int sin_turn[4] = { 0, 1, 0, -1 };
+    double cos_a = cos_turn[turns & 3], sin_a = sin_turn[turns & 3];
+    int along_rows = cos_turn[turns & 3] != 0;     /* grid rows run along input rows */
+    int width_rot, height_rot, projection_offset;
+    int lo = -1, hi = -2;
+    double x, y;
+
+    size_of_rotated_image(&width_rot, &height_rot, height, width, turns * 0.5*M_PI);
+    projection_offset = (height_sin - height_rot) / 2;
+
+    /* run of input pixels every grid row covers, the same for all rows */
+    for (int col = 0; col < width_rot; col++) {
+        double v, limit;
+        int index;
+
+        rotate_position(&x, &y, col, 0, cos_a, sin_a, width_rot, height_rot, width, height);
+        v = along_rows ? x : y;
+        limit = along_rows ? width - 1 : height - 1;
+        if ( v < 0.0 || v > limit ) continue;
+        index = (int) (v + 0.5);
+        if ( lo < 0 || index < lo ) lo = index;
+        if ( index > hi ) hi = index;
+    }
+
+    /* column sums over the run of input rows, a block of row bytes at a time */
+    if ( !along_rows ) {
+        for (int i0 = 0; i0 < width*channels; i0 += COLUMN_BLOCK) {
+            unsigned int* block = sums + i0;
+            int n = width*channels - i0 < COLUMN_BLOCK ? width*channels - i0 : COLUMN_BLOCK;
+
+            memset(block, 0, n*sizeof(unsigned int));
+            for (int row = lo; row <= hi; row++) {
+                const unsigned char* in = input_image + (long) row*width*channels + i0;
+                for (int i = 0; i < n; i++) block[i] += in[i];
+            }
+        }
+    }
+
+    for (int row = 0; row < height_rot; row++) {
+        float* out;
+        double v, limit;
+        int index;
+
+        if ( row + projection_offset < 0 || row + projection_offset >= height_sin ) continue;
+        out = projection + (row + projection_offset)*channels;
+
+        /* the input row or column this grid row lies on */
+        rotate_position(&x, &y, 0, row, cos_a, sin_a, width_rot, height_rot, width, height);
+        v = along_rows ? y : x;
+        limit = along_rows ? height - 1 : width - 1;
+        if ( v < 0.0 || v > limit || lo > hi ) {
+            for ( int c = 0; c < channels; c++ ) out[c] = 0.0f;
+            continue;
+        }
+        index = (int) (v + 0.5);
+
+        if ( along_rows ) {
+            const unsigned char* pixel = input_image + ((long) index*width + lo)*channels;
+            for ( int c = 0; c < channels; c++ ) {
+                unsigned int sum = 0;
+                for (int i = 0; i <= hi - lo; i++) {
+                    sum += pixel[i*channels + c];
+                }
+                out[c] = (float) sum;
+            }
+        }
+        else {
+            for ( int c = 0; c < channels; c++ ) {
+                out[c] = (float) sums[index*channels + c];
+            }
+        }
+    }
+}
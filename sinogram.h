@@ -0,0 +1,208 @@
+#ifndef SINOGRAM_H
+#define SINOGRAM_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+enum CHANNELS { RED, GREEN, BLUE, ALPHA, NUM_CHANNELS };
+
+/* how a single sinogram column is computed */
+enum PROJECTOR {
+    PROJECT_ROTATE, /* rotate the whole image, then sum its rows */
+    PROJECT_RAY,    /* integrate along each detector ray directly in the input image */
+    PROJECT_FAN,    /* rays diverging from a point source, see struct fan_geometry */
+    PROJECT_CONE    /* 3D rays from a point source onto a flat 2D detector, volumes only */
+};
+
+/* fan-beam (and cone-beam) geometry, all distances in pixels of the input image */
+struct fan_geometry {
+    double sid;         /* source to isocenter (the image center) */
+    double sdd;         /* source to detector */
+    double spacing;     /* detector bin pitch, across a flat detector or along a curved one */
+    int curved;         /* equiangular detector on an arc around the source, else flat */
+};
+
+/* how the input image is sampled at non-integer positions */
+enum INTERPOLATION { NEAREST, BILINEAR };
+
+/* how the rotate projector rotates: one 2D gather with the sampler of enum INTERPOLATION,
+   or three 1D shears with a linear or windowed sinc filter */
+enum ROTATION { ROTATION_GATHER, ROTATION_SHEAR, ROTATION_SHEAR_SINC };
+
+/* file formats of the computed sinogram */
+enum SINOGRAM_FORMAT {
+    FORMAT_PNG8,    /* 8-bit PNG, line integrals divided by height_sin */
+    FORMAT_NPY16,   /* 16-bit NPY, same scaling stretched to 0..65535 */
+    FORMAT_NPY32,   /* float32 NPY, line integrals */
+    FORMAT_RAW32    /* float32 without header, line integrals */
+};
+
+/* ramp filter window used for filtered back-projection */
+enum FILTER { FILTER_RAM_LAK, FILTER_SHEPP_LOGAN, FILTER_HANN };
+
+/* levels of the vectorized samplers, in increasing order */
+enum SIMD_LEVEL { SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512 };
+
+/* sample count pixels starting at (x,y) and advancing by (dx,dy), all channels are written to row */
+typedef void (*sample_row_fn)(unsigned char* row, unsigned char* input_image, int width, int height, int channels, double x, double y, double dx, double dy, int count);
+
+struct thread_pool;
+struct dump_writer;
+struct scratch_arena;
+struct system_matrix;
+
+/* everything needed to compute the projection of one angle */
+struct sinogram_job {
+    unsigned char* input_image;
+    int width, height, channels;
+    float* sinogram;        /* line integrals, projection-major: angles x height_sin x channels */
+    int height_sin, angles;
+    double angle_start, angle_delta;   /* degrees, projection i is at angle_start + i*angle_delta */
+    enum PROJECTOR projector;
+    enum INTERPOLATION interp;
+    enum ROTATION rotation;            /* PROJECT_ROTATE only */
+    struct fan_geometry fan;           /* PROJECT_FAN only */
+    struct scratch_arena* scratch;     /* one slab of rotation_scratch_bound() bytes per worker thread */
+    struct dump_writer* dumps;         /* write every rotated image to rotated<angle>.png, NULL = off */
+    int symmetry;                      /* PROJECT_RAY: mirror projections 180 degrees apart instead of projecting both */
+};
+
+void draw_channel(unsigned char* input_image, int width, int height, int channels, enum CHANNELS offset);
+
+void size_of_rotated_image(int* width_rot, int* height_rot, int height, int width, double angle_rad);
+
+void rotate_image(unsigned char* rotated_image, unsigned char* input_image, double angle_rad, int width, int height, int width_rot, int height_rot, int channels, enum INTERPOLATION interp);
+
+/* position in the input image of pixel (col,row) of the rotated image */
+void rotate_position(double* x, double* y, int col, int row, double cos_a, double sin_a, int width_rot, int height_rot, int width, int height);
+
+/* sum the rows of the rotated image into one projection of height_sin x channels */
+void fill_sinogram(float* projection, int height_sin, unsigned char* rotated_image, int width_rot, int height_rot, int channels);
+
+/* projection at turns*90 degrees straight from the row or column sums of the input image, as rotate_image()
+   and fill_sinogram() would give it with exact trigonometry and nearest sampling; sums is scratch of width*channels */
+void project_quarter_turn(float* projection, int height_sin, unsigned char* input_image, int width, int height, int channels, int turns, unsigned int* sums);
+
+/* shear.c */
+/* bytes of float scratch rotate_image_shear() needs for a width x height image */
+size_t shear_scratch_bound(int width, int height, int channels);
+
+/* the same rotated image as rotate_image(), from three 1D shears filtered as rotation says */
+void rotate_image_shear(unsigned char* rotated_image, unsigned char* input_image, double angle_rad, int width, int height, int width_rot, int height_rot, int channels, enum ROTATION rotation, float* scratch);
+
+/* samplers write all channels of the input image at position (x,y) into pixel */
+void nearest_neighbour(unsigned char* pixel, unsigned char* input_image, double x, double y, int width, int height, int channels);
+
+void bilinear_interp(unsigned char* pixel, unsigned char* input_image, double x, double y, int width, int height, int channels);
+
+/* sampler.c */
+enum SIMD_LEVEL simd_level(void);
+
+/* never dispatch above level (e.g. SIMD_SCALAR to compare against the reference samplers) */
+void limit_simd_level(enum SIMD_LEVEL level);
+
+sample_row_fn select_sampler(enum INTERPOLATION interp);
+
+/* projector.c */
+void ray_sum(float* sum, unsigned char* input_image, int width, int height, int channels, double x0, double y0, double dir_x, double dir_y);
+
+/* ray_sum() of a single channel float image, e.g. a slice of a 16-bit or float volume */
+float ray_sum_float(const float* image, int width, int height, double x0, double y0, double dir_x, double dir_y);
+
+/* pixel indices (row-major, no channels) and weights of the line integral ray_sum() computes,
+   returns the number of taps, at most 2*max(width,height) */
+int ray_taps(unsigned int* pixels, float* weights, int width, int height, double x0, double y0, double dir_x, double dir_y);
+
+/* start (x0,y0) in pixel index coordinates of the ray of detector bin det, running along (cos_a,sin_a) */
+void detector_ray(double* x0, double* y0, int det, int height_sin, int width, int height, double cos_a, double sin_a);
+
+void project_rays(float* projection, int height_sin, unsigned char* input_image, int width, int height, int channels, double angle_rad);
+
+/* ray of detector bin det from the fan-beam source, (dir_x,dir_y) is a unit vector */
+void fan_ray(double* x0, double* y0, double* dir_x, double* dir_y, int det, int height_sin, int width, int height, double cos_a, double sin_a, const struct fan_geometry* fan);
+
+void project_fan(float* projection, int height_sin, unsigned char* input_image, int width, int height, int channels, double angle_rad, const struct fan_geometry* fan);
+
+/* detector bins needed for the fan to cover the circle around a width x height image */
+int fan_detectors(const struct fan_geometry* fan, int width, int height);
+
+void project_rays_float(float* projection, int height_sin, const float* image, int width, int height, double angle_rad);
+
+/* scratch.c */
+struct scratch_arena* scratch_create(int slabs, size_t slab_size);
+
+/* slab of the worker thread index */
+void* scratch_slab(struct scratch_arena* arena, int index);
+
+size_t scratch_slab_size(struct scratch_arena* arena);
+
+void scratch_destroy(struct scratch_arena* arena);
+
+/* engine.c */
+/* bytes of the largest rotated image of a width x height image, at any angle */
+size_t rotated_image_bound(int width, int height, int channels);
+
+/* bytes of one scratch slab of the rotate projector: the rotated image, then what the rotation needs */
+size_t rotation_scratch_bound(int width, int height, int channels, enum ROTATION rotation);
+
+/* byte offset of the rotate_image_shear() scratch within such a slab */
+size_t shear_scratch_offset(int width, int height, int channels);
+
+void project_angle(struct sinogram_job* job, int angle_index, int thread);
+
+void project_all_angles(struct sinogram_job* job, struct thread_pool* pool);
+
+/* fbp.c */
+/* 2*height_sin-1 taps of the spatial filter, centered on tap height_sin-1 */
+void filter_kernel(float* kernel, int height_sin, enum FILTER filter);
+
+/* drop the filter spectra cached per detector length */
+void release_filter_spectra(void);
+
+/* reconstruct a width x height float image (interleaved channels) from a projection-major sinogram of line integrals,
+   in the detector geometry of the projector that made it, -1 if out of memory */
+int reconstruct_fbp(float* image, int width, int height, float* sinogram, int angles, int height_sin, int channels, double angle_start, double angle_delta, enum FILTER filter, enum PROJECTOR projector, struct thread_pool* pool);
+
+/* dump.c */
+/* background PNG writer holding at most capacity pending images, NULL if it cannot be started */
+struct dump_writer* dump_writer_create(int capacity, int compression_level);
+
+/* queue a copy of image for writing, waits while the queue is full */
+void dump_image(struct dump_writer* writer, const char* filename, unsigned char* image, int width, int height, int channels);
+
+/* write everything still queued and stop the writer thread */
+void dump_writer_destroy(struct dump_writer* writer);
+
+/* batch.c */
+/* every slice of a batch is projected with the same settings */
+struct batch_job {
+    char** input_filenames;
+    int count;
+    const char* output_dir;
+    enum SINOGRAM_FORMAT format;
+    struct sinogram_job projection;    /* shared geometry and projector, image and sinogram are set per slice */
+    struct system_matrix* matrix;      /* shared ray weights, NULL = projector loop */
+};
+
+/* image files of a directory (sorted by name) or listed one per line in a text file, NULL if none */
+char** list_slices(const char* path, int* count);
+
+void free_slices(char** filenames, int count);
+
+/* decode, project and encode all slices pipelined on separate threads, returns the number of failed slices */
+int run_batch(struct batch_job* batch, struct thread_pool* pool);
+
+/* sinogram_io.c */
+/* NPY 1.0 header of a C-order array, the data written next starts on a 64 byte boundary */
+void write_npy_header(FILE* file, const char* descr, int ndim, const long long* shape);
+
+/* blocked transpose of a rows x cols x channels array into cols x rows x channels */
+void transpose_sinogram(float* dst, const float* src, int rows, int cols, int channels);
+
+/* write a projection-major sinogram in the conventional height_sin x angles layout, returns 0 on success */
+int write_sinogram(const char* filename, float* projections, int angles, int height_sin, int channels, enum SINOGRAM_FORMAT format);
+
+/* load a sinogram written by write_sinogram() (PNG or NPY) back as projection-major line integrals */
+float* read_sinogram(const char* filename, int* angles, int* height_sin, int* channels);
+
+#endif
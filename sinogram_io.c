@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "stb/stb_image.h"
+#include "stb/stb_image_write.h"
+#include "sinogram.h"
+#include "trace.h"
+
+/*
+ * Sinogram files.
+ *
+ * The sinogram is accumulated as float line integrals (sums of pixel values along a
+ * ray). The 8-bit PNG keeps the historical scaling of fill_sinogram(), sum/height_sin,
+ * the 16-bit output uses the same scaling stretched to 0..65535, and the float32
+ * outputs store the sums unchanged. NPY files are (height_sin, angles[, channels])
+ * arrays readable with numpy.load(); raw files are the same data without a header.
+ *
+ * In memory the sinogram is projection-major (angles x height_sin x channels) so that
+ * the projectors write one contiguous block per angle. Files keep the conventional
+ * image layout, one column per angle, and are transposed on the way in and out.
+ */
+
+/* tile edge of the transpose, a 32 x 32 tile of RGBA floats stays within L1 */
+#define TRANSPOSE_BLOCK 32
+
+static int little_endian(void) {
+    unsigned short probe = 1;
+    return *(unsigned char*) &probe == 1;
+}
+
+void write_npy_header(FILE* file, const char* descr, int ndim, const long long* shape) {
+    char header[256];
+    int len;
+
+    len = sprintf(header, "{'descr': '%c%s', 'fortran_order': False, 'shape': (", little_endian() ? '<' : '>', descr);
+    for (int i = 0; i < ndim; i++) {
+        len += sprintf(header + len, i > 0 ? ", %lld" : "%lld", shape[i]);
+    }
+    /* a one element tuple needs its trailing comma */
+    len += sprintf(header + len, ndim == 1 ? ",), }" : "), }");
+
+    /* NPY version 1.0 header, padded so the data starts on a 64 byte boundary */
+    while ( (10 + len + 1) % 64 != 0 ) {
+        header[len++] = ' ';
+    }
+    header[len++] = '\n';
+
+    fwrite("\x93NUMPY\x01\x00", 1, 8, file);
+    fputc(len & 0xFF, file);
+    fputc(len >> 8, file);
+    fwrite(header, 1, len, file);
+}
+
+void transpose_sinogram(float* dst, const float* src, int rows, int cols, int channels) {
+    for (int row0 = 0; row0 < rows; row0 += TRANSPOSE_BLOCK) {
+        int row1 = row0 + TRANSPOSE_BLOCK < rows ? row0 + TRANSPOSE_BLOCK : rows;
+        for (int col0 = 0; col0 < cols; col0 += TRANSPOSE_BLOCK) {
+            int col1 = col0 + TRANSPOSE_BLOCK < cols ? col0 + TRANSPOSE_BLOCK : cols;
+            /* both the source rows and the destination rows of a tile stay cached */
+            for (int row = row0; row < row1; row++) {
+                const float* in = src + ((long) row*cols + col0)*channels;
+                for (int col = col0; col < col1; col++) {
+                    float* out = dst + ((long) col*rows + row)*channels;
+                    for (int c = 0; c < channels; c++) {
+                        out[c] = in[c];
+                    }
+                    in += channels;
+                }
+            }
+        }
+    }
+}
+
+int write_sinogram(const char* filename, float* projections, int angles, int height_sin, int channels, enum SINOGRAM_FORMAT format) {
+    long N = (long) angles*height_sin*channels;
+    long long shape[3] = { height_sin, angles, channels };
+    float* sinogram;
+    FILE* file;
+    int ok;
+
+    /* conventional image layout, one column per angle */
+    sinogram = malloc(N*sizeof(float));
+    if ( !sinogram ) return -1;
+    transpose_sinogram(sinogram, projections, angles, height_sin, channels);
+
+    if ( format == FORMAT_PNG8 ) {
+        unsigned char* image = malloc(N);
+        for (long i = 0; i < N; i++) {
+            float val = sinogram[i] / height_sin;
+            image[i] = val > 255.0f ? 255 : (unsigned char) val;
+        }
+        TRACE_BEGIN(png_time);
+        ok = stbi_write_png(filename, angles, height_sin, channels, image, angles*channels);
+        TRACE_END(png_time, "stbi_write_png", angles);
+        free(image);
+        free(sinogram);
+        return ok ? 0 : -1;
+    }
+
+    file = fopen(filename, "wb");
+    if ( !file ) {
+        free(sinogram);
+        return -1;
+    }
+
+    if ( format == FORMAT_NPY16 ) {
+        unsigned short* data = malloc(N*sizeof(unsigned short));
+        for (long i = 0; i < N; i++) {
+            /* 255*257 = 65535 */
+            float val = sinogram[i] / height_sin * 257.0f + 0.5f;
+            data[i] = val > 65535.0f ? 65535 : (unsigned short) val;
+        }
+        write_npy_header(file, "u2", channels > 1 ? 3 : 2, shape);
+        ok = fwrite(data, sizeof(unsigned short), N, file) == (size_t) N;
+        free(data);
+    }
+    else {
+        if ( format == FORMAT_NPY32 ) {
+            write_npy_header(file, "f4", channels > 1 ? 3 : 2, shape);
+        }
+        ok = fwrite(sinogram, sizeof(float), N, file) == (size_t) N;
+    }
+
+    if ( fclose(file) != 0 ) ok = 0;
+    free(sinogram);
+    return ok ? 0 : -1;
+}
+
+/* parse the NPY header, returns the data type character ('f' or 'u') and its size;
+   the shape must be (height_sin, angles[, channels]) with a float copy that fits memory */
+static int read_npy_header(FILE* file, char* kind, int* size, int* height_sin, int* angles, int* channels) {
+    unsigned char magic[10];
+    char header[1024];
+    char* field;
+    long shape[3] = { 0, 0, 1 };
+    int len, ndim;
+
+    if ( fread(magic, 1, 10, file) != 10 || memcmp(magic, "\x93NUMPY", 6) != 0 || magic[6] != 1 ) return -1;
+    len = magic[8] | magic[9] << 8;
+    if ( len >= (int) sizeof(header) || fread(header, 1, len, file) != (size_t) len ) return -1;
+    header[len] = '\0';
+
+    field = strstr(header, "'descr'");
+    if ( !field || !(field = strchr(field + 7, '\'')) ) return -1;
+    if ( field[1] != (little_endian() ? '<' : '>') && field[1] != '|' ) return -1;
+    *kind = field[2];
+    *size = atoi(field + 3);
+
+    if ( strstr(header, "'fortran_order': True") ) return -1;
+    field = strstr(header, "'shape'");
+    if ( !field || !(field = strchr(field, '(')) ) return -1;
+    for (ndim = 0; ndim < 3; ndim++) {
+        char* end;
+        shape[ndim] = strtol(field + 1, &end, 10);
+        if ( end == field + 1 ) break;
+        field = end;
+        while ( *field == ' ' ) field++;
+        if ( *field != ',' ) { ndim++; break; }
+        field++;
+    }
+    while ( *field == ' ' ) field++;
+    if ( *field != ')' || ndim < 2 ) return -1;
+    if ( shape[0] < 1 || shape[0] > INT_MAX || shape[1] < 1 || shape[1] > INT_MAX || shape[2] < 1 || shape[2] > NUM_CHANNELS ) return -1;
+    if ( (unsigned long long) shape[0]*shape[1] > (unsigned long long) LONG_MAX / sizeof(float) / shape[2] ) return -1;
+    *height_sin = (int) shape[0];
+    *angles = (int) shape[1];
+    *channels = (int) shape[2];
+    return 0;
+}
+
+/* sinogram in the conventional height_sin x angles layout of the file */
+static float* load_sinogram(const char* filename, int* angles, int* height_sin, int* channels) {
+    const char* ext = strrchr(filename, '.');
+    float* sinogram = NULL;
+    long N;
+
+    if ( ext && strcmp(ext, ".npy") == 0 ) {
+        FILE* file = fopen(filename, "rb");
+        char kind;
+        int size;
+
+        if ( !file ) return NULL;
+        if ( read_npy_header(file, &kind, &size, height_sin, angles, channels) == 0 ) {
+            N = (long) *angles * *height_sin * *channels;
+            sinogram = malloc(N*sizeof(float));
+
+            if ( sinogram && kind == 'f' && size == 4 ) {
+                if ( fread(sinogram, sizeof(float), N, file) != (size_t) N ) {
+                    free(sinogram);
+                    sinogram = NULL;
+                }
+            }
+            else if ( sinogram && kind == 'u' && size == 2 ) {
+                unsigned short* data = malloc(N*sizeof(unsigned short));
+                if ( data && fread(data, sizeof(unsigned short), N, file) == (size_t) N ) {
+                    for (long i = 0; i < N; i++) {
+                        sinogram[i] = data[i] / 257.0f * *height_sin;
+                    }
+                }
+                else {
+                    free(sinogram);
+                    sinogram = NULL;
+                }
+                free(data);
+            }
+            else {
+                free(sinogram);
+                sinogram = NULL;
+            }
+        }
+        fclose(file);
+        return sinogram;
+    }
+
+    /* 8-bit image as written by write_sinogram() */
+    unsigned char* image = stbi_load(filename, angles, height_sin, channels, 0);
+    if ( !image ) return NULL;
+    N = (long) *angles * *height_sin * *channels;
+    sinogram = malloc(N*sizeof(float));
+    for (long i = 0; sinogram && i < N; i++) {
+        sinogram[i] = (float) image[i] * *height_sin;
+    }
+    stbi_image_free(image);
+    return sinogram;
+}
+
+float* read_sinogram(const char* filename, int* angles, int* height_sin, int* channels) {
+    float* sinogram = load_sinogram(filename, angles, height_sin, channels);
+    float* projections;
+
+    if ( !sinogram ) return NULL;
+    projections = malloc((long) *angles * *height_sin * *channels * sizeof(float));
+    if ( projections ) {
+        transpose_sinogram(projections, sinogram, *height_sin, *angles, *channels);
+    }
+    free(sinogram);
+    return projections;
+}
@@ -0,0 +1,5 @@
+/* the single translation unit holding the stb implementations, shared by main.exe and bench.exe */
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb/stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb/stb_image_write.h"
@@ -0,0 +1,418 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "sinogram.h"
+#include "sysmatrix.h"
+#include "threads.h"
+
+/*
+ * Sparse system matrix.
+ *
+ * Building runs the ray-driven projector once per sinogram bin, recording the taps
+ * ray_taps() reports instead of summing pixel values: a first pass counts the taps of
+ * every row, a prefix sum turns the counts into row_ptr, and a second pass writes the
+ * taps in place. Both passes are spread over the worker pool by angle.
+ *
+ * The forward product gives every worker whole projections, like the angle loop. The
+ * transpose product scatters every row into the image, one angle at a time. Within one
+ * angle, rays two or more bins apart never share a pixel, since the Joseph projector
+ * touches two neighbours along the ray's minor axis and neighbouring rays are at least
+ * a pixel apart on it. So the bins of an angle are cut into chunks of at least two, and
+ * the even and the odd chunks are scattered in two phases without any locking or
+ * per-thread images.
+ */
+
+#define MATRIX_MAGIC "SINOMTX1"
+#define MATRIX_ALIGN 64
+#define MATRIX_BYTE_ORDER 0x01020304u
+
+/* chunks of detector bins per worker thread in a scatter phase, for load balance */
+#define SCATTER_CHUNKS_PER_THREAD 4
+
+/* 64 bytes, followed by the row_ptr, cols and weights sections */
+struct matrix_header {
+    char magic[8];
+    int32_t width, height, height_sin, angles;
+    double angle_start, angle_delta;
+    int64_t nnz;
+    uint32_t byte_order;            /* MATRIX_BYTE_ORDER as written, files are not portable across endianness */
+    char reserved[12];
+};
+
+static size_t align_section(size_t offset) {
+    return (offset + MATRIX_ALIGN-1) / MATRIX_ALIGN * MATRIX_ALIGN;
+}
+
+/* offsets of the sections and total size for a matrix of rows rows and nnz entries */
+static void matrix_layout(long rows, int64_t nnz, size_t* cols_offset, size_t* weights_offset, size_t* size) {
+    *cols_offset = align_section(sizeof(struct matrix_header) + (rows + 1)*sizeof(int64_t));
+    *weights_offset = align_section(*cols_offset + nnz*sizeof(uint32_t));
+    *size = *weights_offset + nnz*sizeof(float);
+}
+
+/* point the matrix fields at the header and sections in base */
+static void attach_sections(struct system_matrix* matrix) {
+    const struct matrix_header* header = matrix->base;
+    size_t cols_offset, weights_offset, size;
+
+    matrix->width = header->width;
+    matrix->height = header->height;
+    matrix->height_sin = header->height_sin;
+    matrix->angles = header->angles;
+    matrix->angle_start = header->angle_start;
+    matrix->angle_delta = header->angle_delta;
+    matrix->nnz = header->nnz;
+
+    matrix_layout((long) header->angles*header->height_sin, header->nnz, &cols_offset, &weights_offset, &size);
+    matrix->row_ptr = (const int64_t*) ((const char*) matrix->base + sizeof(struct matrix_header));
+    matrix->cols = (const uint32_t*) ((const char*) matrix->base + cols_offset);
+    matrix->weights = (const float*) ((const char*) matrix->base + weights_offset);
+}
+
+struct build_job {
+    int width, height, height_sin;
+    double* cos_a;
+    double* sin_a;
+    int64_t* row_ptr;
+    uint32_t* cols;
+    float* weights;
+    struct scratch_arena* scratch;
+    int max_taps;
+};
+
+static void count_task(void* ctx, int item, int thread) {
+    struct build_job* job = ctx;
+    unsigned int* pixels = scratch_slab(job->scratch, thread);
+    float* weights = (float*) (pixels + job->max_taps);
+    double x0, y0;
+
+    for (int det = 0; det < job->height_sin; det++) {
+        detector_ray(&x0, &y0, det, job->height_sin, job->width, job->height, job->cos_a[item], job->sin_a[item]);
+        /* counts go one row ahead, the prefix sum makes them offsets */
+        job->row_ptr[(long) item*job->height_sin + det + 1] = ray_taps(pixels, weights, job->width, job->height, x0, y0, job->cos_a[item], job->sin_a[item]);
+    }
+}
+
+static void fill_task(void* ctx, int item, int thread) {
+    struct build_job* job = ctx;
+    double x0, y0;
+    (void) thread;
+
+    for (int det = 0; det < job->height_sin; det++) {
+        int64_t start = job->row_ptr[(long) item*job->height_sin + det];
+        detector_ray(&x0, &y0, det, job->height_sin, job->width, job->height, job->cos_a[item], job->sin_a[item]);
+        ray_taps((unsigned int*) job->cols + start, job->weights + start, job->width, job->height, x0, y0, job->cos_a[item], job->sin_a[item]);
+    }
+}
+
+struct system_matrix* system_matrix_build(int width, int height, int height_sin, int angles, double angle_start, double angle_delta, struct thread_pool* pool) {
+    struct system_matrix* matrix;
+    struct matrix_header* header;
+    struct build_job job;
+    long rows = (long) angles*height_sin;
+    int64_t* counts;
+    size_t cols_offset, weights_offset, size;
+
+    /* columns are 32 bit pixel indices */
+    if ( (double) width*height > 4294967295.0 ) return NULL;
+
+    memset(&job, 0, sizeof(job));
+    job.width = width;
+    job.height = height;
+    job.height_sin = height_sin;
+    job.max_taps = 2*(width > height ? width : height);
+    job.cos_a = malloc(angles*sizeof(double));
+    job.sin_a = malloc(angles*sizeof(double));
+    counts = calloc(rows + 1, sizeof(int64_t));
+    job.scratch = scratch_create(pool_size(pool), job.max_taps*(sizeof(unsigned int) + sizeof(float)));
+    if ( !job.cos_a || !job.sin_a || !counts || !job.scratch ) {
+        matrix = NULL;
+        goto done;
+    }
+    for (int a = 0; a < angles; a++) {
+        double angle_rad = (angle_start + a*angle_delta) * M_PI / 180.0;
+        job.cos_a[a] = cos(angle_rad);
+        job.sin_a[a] = sin(angle_rad);
+    }
+
+    /* first pass, taps per row */
+    job.row_ptr = counts;
+    pool_run(pool, angles, count_task, &job);
+    for (long row = 0; row < rows; row++) {
+        counts[row + 1] += counts[row];
+    }
+
+    /* one block laid out like the file */
+    matrix_layout(rows, counts[rows], &cols_offset, &weights_offset, &size);
+    matrix = calloc(1, sizeof(*matrix));
+    if ( matrix ) matrix->base = malloc(size);
+    if ( !matrix || !matrix->base ) {
+        free(matrix);
+        matrix = NULL;
+        goto done;
+    }
+    matrix->size = size;
+
+    header = matrix->base;
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, MATRIX_MAGIC, 8);
+    header->width = width;
+    header->height = height;
+    header->height_sin = height_sin;
+    header->angles = angles;
+    header->angle_start = angle_start;
+    header->angle_delta = angle_delta;
+    header->nnz = counts[rows];
+    header->byte_order = MATRIX_BYTE_ORDER;
+    attach_sections(matrix);
+    memcpy((void*) matrix->row_ptr, counts, (rows + 1)*sizeof(int64_t));
+
+    /* second pass, taps written straight into their rows */
+    job.row_ptr = counts;
+    job.cols = (uint32_t*) matrix->cols;
+    job.weights = (float*) matrix->weights;
+    pool_run(pool, angles, fill_task, &job);
+
+done:
+    scratch_destroy(job.scratch);
+    free(counts);
+    free(job.sin_a);
+    free(job.cos_a);
+    return matrix;
+}
+
+int system_matrix_save(struct system_matrix* matrix, const char* filename) {
+    FILE* file = fopen(filename, "wb");
+    int ok;
+
+    if ( !file ) return -1;
+    ok = fwrite(matrix->base, 1, matrix->size, file) == matrix->size;
+    if ( fclose(file) != 0 ) ok = 0;
+    return ok ? 0 : -1;
+}
+
+/* read-only mapping of the whole file, *mapping is set to a non-NULL handle */
+static void* map_file(const char* filename, size_t* size, void** mapping) {
+#ifdef _WIN32
+    HANDLE file, map;
+    LARGE_INTEGER file_size;
+    void* base = NULL;
+
+    file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if ( file == INVALID_HANDLE_VALUE ) return NULL;
+    if ( GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0 ) {
+        map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if ( map ) {
+            base = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+            if ( base ) {
+                *size = (size_t) file_size.QuadPart;
+                *mapping = map;
+            }
+            else {
+                CloseHandle(map);
+            }
+        }
+    }
+    /* the mapping keeps the file open */
+    CloseHandle(file);
+    return base;
+#else
+    struct stat st;
+    void* base;
+    int fd = open(filename, O_RDONLY);
+
+    if ( fd < 0 ) return NULL;
+    if ( fstat(fd, &st) != 0 || st.st_size <= 0 ) {
+        close(fd);
+        return NULL;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if ( base == MAP_FAILED ) return NULL;
+    *size = st.st_size;
+    *mapping = base;
+    return base;
+#endif
+}
+
+static void unmap_file(void* base, size_t size, void* mapping) {
+#ifdef _WIN32
+    (void) size;
+    UnmapViewOfFile(base);
+    CloseHandle(mapping);
+#else
+    (void) mapping;
+    munmap(base, size);
+#endif
+}
+
+/* row_ptr runs from 0 to nnz without stepping back and every column is a pixel, so no product reads out of bounds */
+static int valid_sections(const struct system_matrix* matrix) {
+    long rows = (long) matrix->angles*matrix->height_sin;
+    uint64_t pixels = (uint64_t) matrix->width*matrix->height;
+
+    if ( matrix->row_ptr[0] != 0 || matrix->row_ptr[rows] != matrix->nnz ) return 0;
+    for (long row = 0; row < rows; row++) {
+        if ( matrix->row_ptr[row + 1] < matrix->row_ptr[row] ) return 0;
+    }
+    for (int64_t k = 0; k < matrix->nnz; k++) {
+        if ( matrix->cols[k] >= pixels ) return 0;
+    }
+    return 1;
+}
+
+struct system_matrix* system_matrix_load(const char* filename) {
+    struct system_matrix* matrix;
+    const struct matrix_header* header;
+    size_t cols_offset, weights_offset, size;
+    void* mapping = NULL;
+
+    matrix = calloc(1, sizeof(*matrix));
+    if ( !matrix ) return NULL;
+    matrix->base = map_file(filename, &matrix->size, &mapping);
+    if ( !matrix->base ) {
+        free(matrix);
+        return NULL;
+    }
+    matrix->mapping = mapping;
+
+    /* the header has to describe exactly the sections that follow it */
+    header = matrix->base;
+    if ( matrix->size < sizeof(*header) || memcmp(header->magic, MATRIX_MAGIC, 8) != 0 || header->byte_order != MATRIX_BYTE_ORDER
+         || header->width <= 0 || header->height <= 0 || header->height_sin <= 0 || header->angles <= 0 || header->nnz < 0 ) {
+        system_matrix_destroy(matrix);
+        return NULL;
+    }
+    /* counts the file cannot hold would wrap the section offsets around */
+    if ( (uint64_t) header->nnz > matrix->size / (sizeof(uint32_t) + sizeof(float))
+         || (uint64_t) header->angles*header->height_sin >= matrix->size / sizeof(int64_t) ) {
+        system_matrix_destroy(matrix);
+        return NULL;
+    }
+    matrix_layout((long) header->angles*header->height_sin, header->nnz, &cols_offset, &weights_offset, &size);
+    if ( size != matrix->size ) {
+        system_matrix_destroy(matrix);
+        return NULL;
+    }
+    attach_sections(matrix);
+    if ( !valid_sections(matrix) ) {
+        system_matrix_destroy(matrix);
+        return NULL;
+    }
+    return matrix;
+}
+
+int system_matrix_matches(struct system_matrix* matrix, int width, int height, int height_sin, int angles, double angle_start, double angle_delta) {
+    return matrix->width == width && matrix->height == height && matrix->height_sin == height_sin && matrix->angles == angles
+        && matrix->angle_start == angle_start && matrix->angle_delta == angle_delta;
+}
+
+void system_matrix_destroy(struct system_matrix* matrix) {
+    if ( !matrix ) return;
+    if ( matrix->mapping ) {
+        unmap_file(matrix->base, matrix->size, matrix->mapping);
+    }
+    else {
+        free(matrix->base);
+    }
+    free(matrix);
+}
+
+struct product_job {
+    struct system_matrix* matrix;
+    int channels;
+    float* sinogram;
+    const float* const_sinogram;
+    unsigned char* input_image;
+    float* image;
+    int angle;                      /* angle being scattered */
+    int phase;                      /* even or odd chunks */
+    int chunk;                      /* detector bins per scatter item */
+};
+
+static void project_task(void* ctx, int item, int thread) {
+    struct product_job* job = ctx;
+    struct system_matrix* matrix = job->matrix;
+    int channels = job->channels;
+    long first_row = (long) item*matrix->height_sin;
+    float* out = job->sinogram + first_row*channels;
+    float sum[NUM_CHANNELS];
+    (void) thread;
+
+    for (long row = first_row; row < first_row + matrix->height_sin; row++) {
+        for ( int c = 0; c < channels; c++ ) sum[c] = 0.0f;
+        for (int64_t k = matrix->row_ptr[row]; k < matrix->row_ptr[row + 1]; k++) {
+            float weight = matrix->weights[k];
+            const unsigned char* pixel = job->input_image + (size_t) matrix->cols[k]*channels;
+            for ( int c = 0; c < channels; c++ ) {
+                sum[c] += weight * pixel[c];
+            }
+        }
+        for ( int c = 0; c < channels; c++ ) {
+            *out++ = sum[c];
+        }
+    }
+}
+
+void system_matrix_project(struct system_matrix* matrix, float* sinogram, unsigned char* input_image, int channels, struct thread_pool* pool) {
+    struct product_job job;
+
+    memset(&job, 0, sizeof(job));
+    job.matrix = matrix;
+    job.channels = channels;
+    job.sinogram = sinogram;
+    job.input_image = input_image;
+    pool_run(pool, matrix->angles, project_task, &job);
+}
+
+/* image += A_i^T sinogram_i for the bins of one chunk of the current angle */
+static void scatter_task(void* ctx, int item, int thread) {
+    struct product_job* job = ctx;
+    struct system_matrix* matrix = job->matrix;
+    int channels = job->channels;
+    int first = (2*item + job->phase)*job->chunk;
+    int last = first + job->chunk < matrix->height_sin ? first + job->chunk : matrix->height_sin;
+    (void) thread;
+
+    for (long row = (long) job->angle*matrix->height_sin + first; row < (long) job->angle*matrix->height_sin + last; row++) {
+        const float* in = job->const_sinogram + row*channels;
+        for (int64_t k = matrix->row_ptr[row]; k < matrix->row_ptr[row + 1]; k++) {
+            float weight = matrix->weights[k];
+            float* pixel = job->image + (size_t) matrix->cols[k]*channels;
+            for ( int c = 0; c < channels; c++ ) {
+                pixel[c] += weight * in[c];
+            }
+        }
+    }
+}
+
+void system_matrix_backproject(struct system_matrix* matrix, float* image, const float* sinogram, int channels, const int* angles, int count, struct thread_pool* pool) {
+    struct product_job job;
+    int chunks;
+
+    memset(&job, 0, sizeof(job));
+    job.matrix = matrix;
+    job.channels = channels;
+    job.const_sinogram = sinogram;
+    job.image = image;
+    job.chunk = matrix->height_sin / (2*SCATTER_CHUNKS_PER_THREAD*pool_size(pool));
+    if ( job.chunk < 2 ) job.chunk = 2;
+    chunks = (matrix->height_sin + job.chunk-1) / job.chunk;
+
+    if ( !angles ) count = matrix->angles;
+    for (int i = 0; i < count; i++) {
+        job.angle = angles ? angles[i] : i;
+        for (job.phase = 0; job.phase < 2; job.phase++) {
+            pool_run(pool, (chunks + 1 - job.phase) / 2, scatter_task, &job);
+        }
+    }
+}
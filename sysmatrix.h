@@ -0,0 +1,78 @@
+#ifndef SYSMATRIX_H
+#define SYSMATRIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Precomputed system matrix of the ray-driven projector.
+ *
+ * Every sinogram bin is a weighted sum of input pixels, so for a fixed geometry (image
+ * size, detector count, angle set) the whole projection is one sparse matrix. It is
+ * stored in CSR form, one row per sinogram bin in projection-major order (row =
+ * angle*height_sin + det) and one column per pixel (row-major, channels excluded), with
+ * float weights. Projecting another image of the same geometry is then a sparse
+ * matrix-vector product, and the transpose back-projects a sinogram into an image.
+ *
+ * The file is a 64 byte header followed by row_ptr, cols and weights, each section
+ * starting on a 64 byte boundary, the same layout the matrix has in memory, so a
+ * saved matrix is memory-mapped instead of read.
+ */
+
+struct system_matrix {
+    int width, height;              /* image the columns index */
+    int height_sin, angles;         /* sinogram the rows index */
+    double angle_start, angle_delta;
+    int64_t nnz;
+    const int64_t* row_ptr;         /* angles*height_sin + 1 offsets into cols and weights */
+    const uint32_t* cols;           /* pixel index of every entry */
+    const float* weights;
+    void* base;                     /* header and sections, heap memory or a file mapping */
+    size_t size;
+    void* mapping;                  /* NULL when base is heap memory */
+};
+
+struct thread_pool;
+
+/* weights of the ray-driven projector for this geometry, the angles in degrees */
+struct system_matrix* system_matrix_build(int width, int height, int height_sin, int angles, double angle_start, double angle_delta, struct thread_pool* pool);
+
+/* returns 0 on success */
+int system_matrix_save(struct system_matrix* matrix, const char* filename);
+
+/* map a saved matrix read-only, NULL if it is missing, not a matrix file or its rows or columns are out of range */
+struct system_matrix* system_matrix_load(const char* filename);
+
+/* nonzero if the matrix was built for this geometry */
+int system_matrix_matches(struct system_matrix* matrix, int width, int height, int height_sin, int angles, double angle_start, double angle_delta);
+
+void system_matrix_destroy(struct system_matrix* matrix);
+
+/* projection-major sinogram of line integrals of all channels of input_image */
+void system_matrix_project(struct system_matrix* matrix, float* sinogram, unsigned char* input_image, int channels, struct thread_pool* pool);
+
+/* transpose product over the rows of count angles: image += A^T sinogram, both with interleaved channels, all angles if angles is NULL */
+void system_matrix_backproject(struct system_matrix* matrix, float* image, const float* sinogram, int channels, const int* angles, int count, struct thread_pool* pool);
+
+/* iterative.c */
+/* order in which the subsets of angles are visited */
+enum SUBSET_ORDER { ORDER_SEQUENTIAL, ORDER_BIT_REVERSAL, ORDER_GOLDEN_RATIO };
+
+struct iterative_solver;
+
+/*
+ * Solver for the geometry of matrix, which must outlive it. The angles are split into
+ * subsets interleaved over the whole range, angle a into subset a % subsets, and the
+ * image is updated after every subset: 1 subset is SIRT, one per angle (subsets <= 0)
+ * is SART, anything in between ordered-subsets SART. Row sums and the column sums
+ * of every subset are computed here, the column sums in 16 bits when the floats would
+ * be too many. NULL if out of memory.
+ */
+struct iterative_solver* iterative_create(struct system_matrix* matrix, int subsets, enum SUBSET_ORDER order, int channels, struct thread_pool* pool);
+
+/* iterations passes over all subsets, refining image (interleaved channels, e.g. zeros) towards the projection-major sinogram */
+void iterative_run(struct iterative_solver* solver, float* image, const float* sinogram, int iterations, double relaxation);
+
+void iterative_destroy(struct iterative_solver* solver);
+
+#endif
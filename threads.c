@@ -0,0 +1,238 @@
+#include <stdlib.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "threads.h"
+
+struct worker {
+    struct thread_pool* pool;
+    pthread_t thread;
+    int index;
+};
+
+struct thread_pool {
+    int threads;
+    struct worker* workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;   /* signalled when a new batch is posted */
+    pthread_cond_t done;    /* signalled when the last worker leaves a batch */
+    unsigned long batch;    /* incremented for every pool_run() */
+    int busy;               /* helper workers still inside the current batch */
+    int quit;
+
+    /* current batch */
+    pool_task task;
+    void* ctx;
+    int count;
+    atomic_int next;
+};
+
+int cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int) info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+#endif
+}
+
+double monotonic_seconds(void) {
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double) counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + 1e-9*now.tv_nsec;
+#endif
+}
+
+/* pull items until the batch is exhausted */
+static void drain(struct thread_pool* pool, int thread) {
+    int item;
+    while ( (item = atomic_fetch_add(&pool->next, 1)) < pool->count ) {
+        pool->task(pool->ctx, item, thread);
+    }
+}
+
+static void* worker_main(void* arg) {
+    struct worker* self = arg;
+    struct thread_pool* pool = self->pool;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while ( !pool->quit && pool->batch == seen ) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if ( pool->quit ) break;
+        seen = pool->batch;
+        pthread_mutex_unlock(&pool->lock);
+
+        drain(pool, self->index);
+
+        pthread_mutex_lock(&pool->lock);
+        if ( --pool->busy == 0 ) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+struct thread_pool* pool_create(int threads) {
+    struct thread_pool* pool = calloc(1, sizeof(*pool));
+    if ( !pool ) return NULL;
+    if ( threads < 1 ) threads = 1;
+
+    pool->threads = threads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    atomic_init(&pool->next, 0);
+
+    /* worker 0 is the thread calling pool_run() */
+    pool->workers = calloc(threads, sizeof(*pool->workers));
+    for (int i = 1; i < threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if ( pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]) != 0 ) {
+            /* run with whatever was started */
+            pool->threads = i;
+            break;
+        }
+    }
+    return pool;
+}
+
+int pool_size(struct thread_pool* pool) {
+    return pool ? pool->threads : 1;
+}
+
+void pool_run(struct thread_pool* pool, int count, pool_task task, void* ctx) {
+    if ( !pool || pool->threads == 1 || count <= 1 ) {
+        for (int item = 0; item < count; item++) {
+            task(ctx, item, 0);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->ctx = ctx;
+    pool->count = count;
+    atomic_store(&pool->next, 0);
+    pool->busy = pool->threads - 1;
+    pool->batch++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    drain(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while ( pool->busy > 0 ) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_destroy(struct thread_pool* pool) {
+    if ( !pool ) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 1; i < pool->threads; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+struct queue {
+    void** items;
+    int capacity;
+    int head, count;
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+struct queue* queue_create(int capacity) {
+    struct queue* queue = calloc(1, sizeof(*queue));
+    if ( !queue ) return NULL;
+    if ( capacity < 1 ) capacity = 1;
+
+    queue->items = calloc(capacity, sizeof(void*));
+    queue->capacity = capacity;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    return queue;
+}
+
+int queue_push(struct queue* queue, void* item) {
+    pthread_mutex_lock(&queue->lock);
+    while ( !queue->closed && queue->count == queue->capacity ) {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+    if ( queue->closed ) {
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+    }
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+void* queue_pop(struct queue* queue) {
+    void* item = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+    while ( !queue->closed && queue->count == 0 ) {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+    if ( queue->count > 0 ) {
+        item = queue->items[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return item;
+}
+
+void queue_close(struct queue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = 1;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_cond_broadcast(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void queue_destroy(struct queue* queue) {
+    if ( !queue ) return;
+    pthread_cond_destroy(&queue->not_full);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->items);
+    free(queue);
+}
@@ -0,0 +1,50 @@
+#ifndef THREADS_H
+#define THREADS_H
+
+/*
+ * Minimal persistent worker pool.
+ *
+ * pool_run() hands out items 0..count-1 to the workers and returns once all of them are
+ * done. The calling thread takes part as worker 0, so a pool of one thread runs everything
+ * inline. Every task gets the index of the worker executing it, which callers use to pick
+ * per-thread scratch memory without any locking.
+ */
+
+typedef void (*pool_task)(void* ctx, int item, int thread);
+
+struct thread_pool;
+
+int cpu_count(void);
+
+/* seconds on a monotonic clock, for wall time measurements */
+double monotonic_seconds(void);
+
+struct thread_pool* pool_create(int threads);
+
+int pool_size(struct thread_pool* pool);
+
+void pool_run(struct thread_pool* pool, int count, pool_task task, void* ctx);
+
+void pool_destroy(struct thread_pool* pool);
+
+/*
+ * Bounded blocking queue of pointers, for handing work to a background thread.
+ *
+ * queue_push() blocks while the queue is full, queue_pop() while it is empty. After
+ * queue_close() pushes fail and pops return what is left, then NULL.
+ */
+
+struct queue;
+
+struct queue* queue_create(int capacity);
+
+/* returns 0, or -1 if the queue was closed */
+int queue_push(struct queue* queue, void* item);
+
+void* queue_pop(struct queue* queue);
+
+void queue_close(struct queue* queue);
+
+void queue_destroy(struct queue* queue);
+
+#endif
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "threads.h"
+#include "trace.h"
+
+double trace_now(void) {
+    return monotonic_seconds();
+}
+
+#ifdef SINOGRAM_TRACE
+
+/* summary rows, further scope names are left out of the table but not the trace */
+#define TRACE_MAX_NAMES 64
+
+struct trace_record {
+    const char* name;
+    int arg;
+    double start, end;
+};
+
+/* written only by its own thread, read by trace_export() once the writers are quiet */
+struct trace_ring {
+    int thread;
+    atomic_ulong written;
+    struct trace_record events[TRACE_RING_EVENTS];
+};
+
+static struct trace_ring* _Atomic rings[TRACE_MAX_THREADS];
+static atomic_int ring_count;
+static _Thread_local struct trace_ring* local_ring;
+static _Thread_local int local_untraced;
+
+/* claim a ring on the first event of a thread */
+static struct trace_ring* claim_ring(void) {
+    int index = atomic_fetch_add(&ring_count, 1);
+    struct trace_ring* ring;
+
+    if ( index >= TRACE_MAX_THREADS || !(ring = malloc(sizeof(*ring))) ) {
+        local_untraced = 1;
+        return NULL;
+    }
+    ring->thread = index;
+    atomic_init(&ring->written, 0);
+    atomic_store_explicit(&rings[index], ring, memory_order_release);
+    return ring;
+}
+
+void trace_event(const char* name, int arg, double start) {
+    struct trace_ring* ring = local_ring;
+    unsigned long n;
+
+    if ( !ring ) {
+        if ( local_untraced || !(ring = local_ring = claim_ring()) ) return;
+    }
+    n = atomic_load_explicit(&ring->written, memory_order_relaxed);
+    ring->events[n % TRACE_RING_EVENTS] = (struct trace_record) { name, arg, start, trace_now() };
+    atomic_store_explicit(&ring->written, n + 1, memory_order_release);
+}
+
+/* events still held by ring, the oldest first */
+static unsigned long ring_events(struct trace_ring* ring, unsigned long* first) {
+    unsigned long written = atomic_load_explicit(&ring->written, memory_order_acquire);
+
+    *first = written > TRACE_RING_EVENTS ? written - TRACE_RING_EVENTS : 0;
+    return written - *first;
+}
+
+struct trace_summary {
+    const char* name;
+    long count;
+    double total, max;
+    double thread_min, thread_max;  /* total time of the least and most busy thread */
+};
+
+static void print_summary(int count) {
+    struct trace_summary summary[TRACE_MAX_NAMES];
+    int names = 0;
+
+    for (int r = 0; r < count; r++) {
+        struct trace_ring* ring = atomic_load_explicit(&rings[r], memory_order_acquire);
+        double thread_total[TRACE_MAX_NAMES] = { 0 };
+        unsigned long first, n;
+
+        if ( !ring ) continue;
+        n = ring_events(ring, &first);
+        for (unsigned long i = 0; i < n; i++) {
+            const struct trace_record* event = &ring->events[(first + i) % TRACE_RING_EVENTS];
+            double duration = event->end - event->start;
+            int s = 0;
+
+            while ( s < names && strcmp(summary[s].name, event->name) != 0 ) s++;
+            if ( s == names ) {
+                if ( names == TRACE_MAX_NAMES ) continue;
+                memset(&summary[s], 0, sizeof(summary[s]));
+                summary[s].name = event->name;
+                summary[s].thread_min = -1.0;
+                names++;
+            }
+            summary[s].count++;
+            summary[s].total += duration;
+            if ( duration > summary[s].max ) summary[s].max = duration;
+            thread_total[s] += duration;
+        }
+
+        /* only threads that ran a scope count towards its spread */
+        for (int s = 0; s < names; s++) {
+            if ( thread_total[s] == 0.0 ) continue;
+            if ( summary[s].thread_min < 0.0 || thread_total[s] < summary[s].thread_min ) summary[s].thread_min = thread_total[s];
+            if ( thread_total[s] > summary[s].thread_max ) summary[s].thread_max = thread_total[s];
+        }
+    }
+
+    fprintf(stderr, "%-18s %8s %12s %10s %10s %14s %14s\n", "scope", "count", "total ms", "mean us", "max us", "thread min ms", "thread max ms");
+    for (int s = 0; s < names; s++) {
+        fprintf(stderr, "%-18s %8ld %12.3f %10.1f %10.1f %14.3f %14.3f\n", summary[s].name, summary[s].count,
+                1e3*summary[s].total, 1e6*summary[s].total / summary[s].count, 1e6*summary[s].max,
+                1e3*(summary[s].thread_min < 0.0 ? 0.0 : summary[s].thread_min), 1e3*summary[s].thread_max);
+    }
+}
+
+int trace_export(const char* filename) {
+    int count = atomic_load(&ring_count);
+    double origin = -1.0;
+    unsigned long dropped = 0;
+    int first_event = 1;
+    FILE* file;
+
+    if ( count > TRACE_MAX_THREADS ) count = TRACE_MAX_THREADS;
+
+    /* timestamps relative to the earliest event still held */
+    for (int r = 0; r < count; r++) {
+        struct trace_ring* ring = atomic_load_explicit(&rings[r], memory_order_acquire);
+        unsigned long first, n;
+
+        if ( !ring ) continue;
+        n = ring_events(ring, &first);
+        dropped += first;
+        for (unsigned long i = 0; i < n; i++) {
+            double start = ring->events[(first + i) % TRACE_RING_EVENTS].start;
+            if ( origin < 0.0 || start < origin ) origin = start;
+        }
+    }
+
+    file = fopen(filename, "w");
+    if ( !file ) return -1;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (int r = 0; r < count; r++) {
+        struct trace_ring* ring = atomic_load_explicit(&rings[r], memory_order_acquire);
+        unsigned long first, n;
+
+        if ( !ring ) continue;
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                first_event ? "" : ",\n", ring->thread, ring->thread);
+        first_event = 0;
+
+        n = ring_events(ring, &first);
+        for (unsigned long i = 0; i < n; i++) {
+            const struct trace_record* event = &ring->events[(first + i) % TRACE_RING_EVENTS];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"index\":%d}}",
+                    event->name, ring->thread, 1e6*(event->start - origin), 1e6*(event->end - event->start), event->arg);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    if ( fclose(file) != 0 ) return -1;
+
+    print_summary(count);
+    if ( dropped ) fprintf(stderr, "%lu oldest events were overwritten, the rings hold %d per thread\n", dropped, TRACE_RING_EVENTS);
+    return 0;
+}
+
+#else
+
+void trace_event(const char* name, int arg, double start) {
+    (void) name;
+    (void) arg;
+    (void) start;
+}
+
+int trace_export(const char* filename) {
+    (void) filename;
+    return -1;
+}
+
+#endif
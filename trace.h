@@ -0,0 +1,42 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+ * Hot-path instrumentation, compiled in with -DSINOGRAM_TRACE (make trace).
+ *
+ * TRACE_BEGIN(t) takes a timestamp, TRACE_END(t, name, arg) records the scope from there
+ * as one event with a static name and an integer argument, usually the angle or slice
+ * index. Every thread writes into its own ring of TRACE_RING_EVENTS events without any
+ * locking; a full ring overwrites its oldest events. trace_export() writes all rings as
+ * Chrome trace JSON (chrome://tracing, Perfetto) and prints a summary of every scope name
+ * with the busiest and idlest thread, so imbalance across threads and angles shows.
+ *
+ * Without SINOGRAM_TRACE the macros expand to nothing.
+ */
+
+#define TRACE_RING_EVENTS 65536
+
+/* rings handed out, threads beyond that are not traced */
+#define TRACE_MAX_THREADS 256
+
+#ifdef SINOGRAM_TRACE
+#define TRACE_BEGIN(t) double t = trace_now()
+#define TRACE_END(t, name, arg) trace_event(name, arg, t)
+#else
+#define TRACE_BEGIN(t)
+#define TRACE_END(t, name, arg) ((void) 0)
+#endif
+
+double trace_now(void);
+
+/* record the scope [start, now] on the calling thread's ring */
+void trace_event(const char* name, int arg, double start);
+
+/*
+ * Chrome trace JSON of all events recorded so far into filename and the summary table
+ * to stderr. Call it while no thread is recording. Returns 0 on success, -1 if the file
+ * cannot be written or tracing is not compiled in.
+ */
+int trace_export(const char* filename);
+
+#endif
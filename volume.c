@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sinogram.h"
+#include "threads.h"
+#include "volume.h"
+
+/*
+ * Volume mode.
+ *
+ * In parallel-beam geometry every z-slice projects independently, so the volume is
+ * read a slab of slices at a time, every (slice, angle) pair of the slab is one item
+ * of the worker pool, and the slab's rows of every projection are written straight to
+ * their place in the output file. Memory use is two slab buffers, whatever the depth.
+ */
+
+static int voxel_size(enum VOXEL_TYPE type) {
+    switch ( type ) {
+        case VOXEL_U8:  return 1;
+        case VOXEL_U16:
+        case VOXEL_I16: return 2;
+        default:        return 4;
+    }
+}
+
+static int little_endian(void) {
+    unsigned short probe = 1;
+    return *(unsigned char*) &probe == 1;
+}
+
+/* 64 bit file offsets, volumes are larger than 2 GB */
+static int seek_to(FILE* file, long long offset, int whence) {
+#ifdef _WIN32
+    return _fseeki64(file, offset, whence);
+#else
+    return fseeko(file, (off_t) offset, whence);
+#endif
+}
+
+/* take over file positioned at the first voxel */
+static struct volume_source* volume_create(FILE* file, int width, int height, int depth, enum VOXEL_TYPE type, int big_endian) {
+    struct volume_source* volume;
+
+    if ( width <= 0 || height <= 0 || depth <= 0 ) {
+        fclose(file);
+        return NULL;
+    }
+    volume = calloc(1, sizeof(*volume));
+    if ( volume ) volume->buffer = malloc((size_t) width*height*voxel_size(type));
+    if ( !volume || !volume->buffer ) {
+        free(volume);
+        fclose(file);
+        return NULL;
+    }
+    volume->file = file;
+    volume->width = width;
+    volume->height = height;
+    volume->depth = depth;
+    volume->type = type;
+    volume->swap_bytes = voxel_size(type) > 1 && big_endian == little_endian();
+    return volume;
+}
+
+struct volume_source* volume_open_raw(const char* filename, int width, int height, int depth, enum VOXEL_TYPE type, int big_endian, long long offset) {
+    FILE* file = fopen(filename, "rb");
+
+    if ( !file ) return NULL;
+    if ( offset > 0 && seek_to(file, offset, SEEK_SET) != 0 ) {
+        fclose(file);
+        return NULL;
+    }
+    return volume_create(file, width, height, depth, type, big_endian);
+}
+
+static char* trim(char* text) {
+    char* end;
+
+    while ( *text == ' ' || *text == '\t' ) text++;
+    end = text + strlen(text);
+    while ( end > text && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n') ) end--;
+    *end = '\0';
+    return text;
+}
+
+/* NRRD type names of the supported voxel types, -1 if unsupported */
+static int nrrd_type(const char* name) {
+    static const struct { const char* name; enum VOXEL_TYPE type; } types[] = {
+        { "uchar", VOXEL_U8 }, { "unsigned char", VOXEL_U8 }, { "uint8", VOXEL_U8 }, { "uint8_t", VOXEL_U8 },
+        { "ushort", VOXEL_U16 }, { "unsigned short", VOXEL_U16 }, { "unsigned short int", VOXEL_U16 },
+        { "uint16", VOXEL_U16 }, { "uint16_t", VOXEL_U16 },
+        { "short", VOXEL_I16 }, { "short int", VOXEL_I16 }, { "signed short", VOXEL_I16 },
+        { "signed short int", VOXEL_I16 }, { "int16", VOXEL_I16 }, { "int16_t", VOXEL_I16 },
+        { "float", VOXEL_F32 },
+    };
+
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if ( strcmp(name, types[i].name) == 0 ) return types[i].type;
+    }
+    return -1;
+}
+
+struct volume_source* volume_open_nrrd(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    char line[1024];
+    char data_file[1024] = "";
+    int type = -1, dimension = 0, width = 0, height = 0, depth = 0;
+    int big_endian = !little_endian();
+    long long byte_skip = 0;
+    int raw = 0;
+
+    if ( !file ) return NULL;
+    if ( !fgets(line, sizeof(line), file) || strncmp(line, "NRRD000", 7) != 0 ) {
+        fclose(file);
+        return NULL;
+    }
+
+    /* fields up to the blank line that separates attached data, or up to the end of a detached header */
+    while ( fgets(line, sizeof(line), file) ) {
+        char* value = strstr(line, ": ");
+        char* key = line;
+
+        if ( line[0] == '\n' || (line[0] == '\r' && line[1] == '\n') ) break;
+        if ( line[0] == '#' || !value ) continue;
+        *value = '\0';
+        value = trim(value + 2);
+        key = trim(key);
+
+        if ( strcmp(key, "type") == 0 ) type = nrrd_type(value);
+        else if ( strcmp(key, "dimension") == 0 ) dimension = atoi(value);
+        else if ( strcmp(key, "sizes") == 0 ) sscanf(value, "%d %d %d", &width, &height, &depth);
+        else if ( strcmp(key, "endian") == 0 ) big_endian = strcmp(value, "big") == 0;
+        else if ( strcmp(key, "encoding") == 0 ) raw = strcmp(value, "raw") == 0;
+        else if ( strcmp(key, "byte skip") == 0 || strcmp(key, "byteskip") == 0 ) byte_skip = atoll(value);
+        else if ( strcmp(key, "data file") == 0 || strcmp(key, "datafile") == 0 ) snprintf(data_file, sizeof(data_file), "%s", value);
+    }
+
+    if ( type < 0 || dimension != 3 || !raw ) {
+        fprintf(stderr, "%s: only 3D raw encoded uchar, (u)short or float NRRD volumes are supported\n", filename);
+        fclose(file);
+        return NULL;
+    }
+
+    if ( data_file[0] ) {
+        /* detached data, relative to the header's directory */
+        char path[2048];
+        const char* slash = strrchr(filename, '/');
+        const char* backslash = strrchr(filename, '\\');
+        if ( backslash > slash ) slash = backslash;
+
+        if ( slash && data_file[0] != '/' && data_file[0] != '\\' && data_file[1] != ':' ) {
+            snprintf(path, sizeof(path), "%.*s%s", (int) (slash - filename + 1), filename, data_file);
+        }
+        else {
+            snprintf(path, sizeof(path), "%s", data_file);
+        }
+        fclose(file);
+        file = fopen(path, "rb");
+        if ( !file ) {
+            fprintf(stderr, "Cannot open NRRD data file %s\n", path);
+            return NULL;
+        }
+    }
+
+    /* byte skip -1 means the data ends the file */
+    if ( byte_skip == -1 ) {
+        if ( seek_to(file, -(long long) width*height*depth*voxel_size(type), SEEK_END) != 0 ) {
+            fclose(file);
+            return NULL;
+        }
+    }
+    else if ( byte_skip > 0 && seek_to(file, byte_skip, SEEK_CUR) != 0 ) {
+        fclose(file);
+        return NULL;
+    }
+    return volume_create(file, width, height, depth, type, big_endian);
+}
+
+int volume_read_slices(struct volume_source* volume, float* slices, int count) {
+    size_t voxels = (size_t) volume->width*volume->height;
+    int read;
+
+    for (read = 0; read < count && volume->next_slice < volume->depth; read++) {
+        float* out = slices + read*voxels;
+
+        if ( fread(volume->buffer, voxel_size(volume->type), voxels, volume->file) != voxels ) break;
+        volume->next_slice++;
+
+        if ( volume->type == VOXEL_U8 ) {
+            const unsigned char* in = volume->buffer;
+            for (size_t i = 0; i < voxels; i++) out[i] = in[i];
+        }
+        else if ( volume->type == VOXEL_F32 ) {
+            unsigned int* in = volume->buffer;
+            if ( volume->swap_bytes ) {
+                for (size_t i = 0; i < voxels; i++) {
+                    unsigned int v = in[i];
+                    in[i] = v >> 24 | (v >> 8 & 0xFF00) | (v << 8 & 0xFF0000) | v << 24;
+                }
+            }
+            memcpy(out, in, voxels*sizeof(float));
+        }
+        else {
+            unsigned short* in = volume->buffer;
+            if ( volume->swap_bytes ) {
+                for (size_t i = 0; i < voxels; i++) in[i] = (unsigned short) (in[i] >> 8 | in[i] << 8);
+            }
+            if ( volume->type == VOXEL_U16 ) {
+                for (size_t i = 0; i < voxels; i++) out[i] = in[i];
+            }
+            else {
+                for (size_t i = 0; i < voxels; i++) out[i] = (short) in[i];
+            }
+        }
+    }
+    return read;
+}
+
+void volume_close(struct volume_source* volume) {
+    if ( !volume ) return;
+    fclose(volume->file);
+    free(volume->buffer);
+    free(volume);
+}
+
+struct volume_job {
+    float* slices;
+    int width, height, count;
+    int height_sin;
+    double angle_start, angle_delta;
+    float* projections;             /* angles x count x height_sin */
+};
+
+/* one slice of the slab at one angle */
+static void volume_task(void* ctx, int item, int thread) {
+    struct volume_job* job = ctx;
+    int slice = item % job->count;
+    int angle = item / job->count;
+    double angle_rad = (job->angle_start + angle*job->angle_delta) * M_PI / 180.0;
+    (void) thread;
+
+    project_rays_float(job->projections + ((long) angle*job->count + slice)*job->height_sin, job->height_sin,
+                       job->slices + (long) slice*job->width*job->height, job->width, job->height, angle_rad);
+}
+
+int project_volume(struct volume_source* volume, const char* filename, enum SINOGRAM_FORMAT format, int height_sin, int angles, double angle_start, double angle_delta, int slab, struct thread_pool* pool) {
+    struct volume_job job;
+    long long data_offset = 0;
+    FILE* file;
+    int ok = 1;
+
+    if ( slab < 1 ) slab = 1;
+    if ( slab > volume->depth ) slab = volume->depth;
+
+    memset(&job, 0, sizeof(job));
+    job.width = volume->width;
+    job.height = volume->height;
+    job.height_sin = height_sin;
+    job.angle_start = angle_start;
+    job.angle_delta = angle_delta;
+    job.slices = malloc((size_t) slab*volume->width*volume->height*sizeof(float));
+    job.projections = malloc((size_t) slab*angles*height_sin*sizeof(float));
+    file = fopen(filename, "wb");
+    if ( !job.slices || !job.projections || !file ) {
+        if ( file ) fclose(file);
+        free(job.slices);
+        free(job.projections);
+        return -1;
+    }
+
+    if ( format == FORMAT_NPY32 ) {
+        long long shape[3] = { angles, volume->depth, height_sin };
+        write_npy_header(file, "f4", 3, shape);
+        data_offset = ftell(file);
+    }
+
+    for (int z = 0; z < volume->depth && ok; z += job.count) {
+        job.count = volume_read_slices(volume, job.slices, slab);
+        if ( job.count == 0 ) {
+            fprintf(stderr, "Volume ends after %d of %d slices\n", z, volume->depth);
+            ok = 0;
+            break;
+        }
+        pool_run(pool, job.count*angles, volume_task, &job);
+
+        /* the slab is a run of consecutive rows in every projection */
+        for (int a = 0; a < angles && ok; a++) {
+            long long offset = data_offset + ((long long) a*volume->depth + z)*height_sin*sizeof(float);
+            size_t len = (size_t) job.count*height_sin;
+            ok = seek_to(file, offset, SEEK_SET) == 0 && fwrite(job.projections + (size_t) a*len, sizeof(float), len, file) == len;
+        }
+    }
+
+    if ( fclose(file) != 0 ) ok = 0;
+    free(job.slices);
+    free(job.projections);
+    return ok ? 0 : -1;
+}
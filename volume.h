@@ -0,0 +1,73 @@
+#ifndef VOLUME_H
+#define VOLUME_H
+
+#include <stdio.h>
+#include "sinogram.h"
+
+/*
+ * 3D volumes streamed from disk.
+ *
+ * A volume is a width x height x depth block of scalar voxels, x fastest, as written
+ * by most scanners and by NRRD. It is never loaded as a whole: slices are read in
+ * order, a slab at a time, and converted to float on the way in.
+ */
+
+enum VOXEL_TYPE { VOXEL_U8, VOXEL_U16, VOXEL_I16, VOXEL_F32 };
+
+struct volume_source {
+    FILE* file;
+    int width, height, depth;
+    enum VOXEL_TYPE type;
+    int swap_bytes;                 /* voxels are stored in the other byte order */
+    int next_slice;                 /* slices already read */
+    void* buffer;                   /* one slice of raw voxels */
+};
+
+struct thread_pool;
+
+/* headerless voxels starting at offset, little or big endian */
+struct volume_source* volume_open_raw(const char* filename, int width, int height, int depth, enum VOXEL_TYPE type, int big_endian, long long offset);
+
+/* NRRD with raw encoding, the data attached (.nrrd) or in a detached file (.nhdr) */
+struct volume_source* volume_open_nrrd(const char* filename);
+
+/* read the next count slices as float, returns the number read */
+int volume_read_slices(struct volume_source* volume, float* slices, int count);
+
+void volume_close(struct volume_source* volume);
+
+/*
+ * Parallel-beam projection of every slice, slab slices at a time. The output is a
+ * stack of projections, angles x depth x height_sin floats (FORMAT_NPY32 or FORMAT_RAW32),
+ * so each angle is one 2D projection image of the volume. Returns 0 on success.
+ */
+int project_volume(struct volume_source* volume, const char* filename, enum SINOGRAM_FORMAT format, int height_sin, int angles, double angle_start, double angle_delta, int slab, struct thread_pool* pool);
+
+/* cone.c */
+/* a whole volume in memory, in bricks of 8^3 voxels, x fastest within a brick */
+struct brick_volume {
+    int width, height, depth;
+    int bricks_x, bricks_y, bricks_z;
+    float* voxels;
+};
+
+/* read all remaining slices of volume into bricks */
+struct brick_volume* brick_volume_load(struct volume_source* volume);
+
+void brick_volume_destroy(struct brick_volume* bricks);
+
+/* trilinear interpolation at voxel index coordinates (x,y,z), zero outside the volume */
+float trilinear_sample(const struct brick_volume* volume, double x, double y, double z);
+
+/* fill in a detector size of 0 so the whole volume projects onto it */
+void cone_detector_size(const struct fan_geometry* cone, int width, int height, int depth, int* det_cols, int* det_rows);
+
+/*
+ * Cone-beam projection of volume with the source sid and the flat detector sdd from the
+ * source (cone->curved is ignored), one det_rows x det_cols projection per angle,
+ * written as angles x det_rows x det_cols floats. Returns 0 on success and the ray
+ * throughput of the projection itself in rays_per_second.
+ */
+int project_cone(const struct brick_volume* volume, const char* filename, enum SINOGRAM_FORMAT format, const struct fan_geometry* cone, int det_cols, int det_rows, int angles, double angle_start, double angle_delta, struct thread_pool* pool, double* rays_per_second);
+
+#endif